@@ -23,6 +23,8 @@ pub use runtime::{Ptr,
   EQL, GTE, GTN, NEQ,
   get_tag,
   get_ext,
+  get_fun,
+  get_ari,
   get_val,
   get_num,
   get_loc,
@@ -109,6 +111,7 @@ impl Runtime {
   pub fn from_code_with_size(code: &str, size: usize) -> Result<Runtime, String> {
     let file = language::read_file(code)?;
     let book = rulebook::gen_rulebook(&file);
+    rulebook::check_rulebook(&book)?;
     let funs = builder::build_runtime_functions(&book);
     let mut heap = runtime::new_worker(size);
     heap.aris = builder::build_runtime_arities(&book);
@@ -398,12 +401,13 @@ impl Runtime {
     return runtime::Num(val);
   }
 
-  pub fn Ctr(fun: u64, pos: u64) -> Ptr {
-    return runtime::Ctr(0, fun, pos);
+  // Links carry the arity of their constructor or function
+  pub fn Ctr(ari: u64, fun: u64, pos: u64) -> Ptr {
+    return runtime::Ctr(ari, fun, pos);
   }
 
-  pub fn Fun(fun: u64, pos: u64) -> Ptr {
-    return runtime::Cal(0, fun, pos);
+  pub fn Fun(ari: u64, fun: u64, pos: u64) -> Ptr {
+    return runtime::Cal(ari, fun, pos);
   }
 
   pub fn link(&mut self, loc: u64, lnk: Ptr) -> Ptr {
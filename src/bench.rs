@@ -0,0 +1,453 @@
+// Benchmarks
+// ----------
+
+// `hvm bench` compiles each `bench/*/main.hvm` to a binary (see `compiler::compile_binary`) and
+// runs it on some input sizes and thread counts, a few times each. Timings are noisy, so it reports
+// the median wall time, with its 10th and 90th percentiles, then the rewrites per second, the peak
+// resident memory and the speedup over one thread. Results can be saved to a baseline file, and
+// later runs compared against it, flagging the medians that got slower by more than a threshold.
+
+use crate::compiler;
+use crate::runtime as rt;
+use std::collections::HashMap;
+use std::io::Read;
+use std::path::Path;
+
+pub struct Options {
+  pub names: Vec<String>,
+  pub dir: String,
+  pub sizes: Vec<String>,
+  pub threads: Vec<usize>,
+  pub runs: usize,
+  pub baseline: Option<String>,
+  pub save: Option<String>,
+  pub threshold: f64,
+  pub heap_size: usize,
+  pub rules: bool,
+}
+
+// A single run of a benchmark
+struct Sample {
+  time: f64, // wall time, in seconds
+  cost: u64, // rewrites
+  rss: u64,  // peak resident memory, in bytes
+}
+
+// The runs of a benchmark, on a given size and thread count
+struct Summary {
+  name: String,
+  size: String,
+  threads: usize,
+  median: f64,
+  p10: f64,
+  p90: f64,
+  cost: u64,
+  rss: u64,
+}
+
+// Baselines are keyed by benchmark, size and thread count
+type Key = (String, String, usize);
+
+pub fn run_bench(opts: &Options) -> Result<(), String> {
+  if opts.rules {
+    return run_rules(opts);
+  }
+  let baseline = match &opts.baseline {
+    Some(path) => load_baseline(path)?,
+    None => HashMap::new(),
+  };
+  let threads = if opts.threads.is_empty() { default_threads() } else { opts.threads.clone() };
+  let mut results = Vec::new();
+  let mut regressions = 0;
+
+  for name in bench_names(opts)? {
+    let dir = Path::new(&opts.dir).join(&name);
+    let sizes = if opts.sizes.is_empty() { default_sizes(&dir) } else { opts.sizes.clone() };
+    if sizes.is_empty() {
+      eprintln!("Skipping '{}': no --sizes given, and no sizes file to take them from.", name);
+      continue;
+    }
+    let code = std::fs::read_to_string(dir.join("main.hvm")).map_err(|err| err.to_string())?;
+    let bin = compiler::compile_binary(&code, true)?;
+
+    println!("{}", name);
+    println!(
+      "{:>10} {:>7} {:>10} {:>10} {:>10} {:>9} {:>10} {:>8} {:>9}",
+      "size", "threads", "median", "p10", "p90", "MR/s", "peak RSS", "speedup", "baseline"
+    );
+    for size in &sizes {
+      let mut single = None;
+      for &thread in &threads {
+        let result = run_many(&bin, &name, size, thread, opts)?;
+        if thread == 1 {
+          single = Some(result.median);
+        }
+        let speedup = match single {
+          Some(time) => format!("{:.2}x", time / result.median),
+          None => "-".to_string(),
+        };
+        let mut compare = "-".to_string();
+        if let Some(base) = baseline.get(&(name.clone(), size.clone(), thread)) {
+          let delta = (result.median / base - 1.0) * 100.0;
+          compare = format!("{:+.1}%", delta);
+          if delta > opts.threshold {
+            compare.push_str(" REGRESSION");
+            regressions += 1;
+          }
+        }
+        println!(
+          "{:>10} {:>7} {:>10} {:>10} {:>10} {:>9.2} {:>10} {:>8} {:>9}",
+          size,
+          thread,
+          show_time(result.median),
+          show_time(result.p10),
+          show_time(result.p90),
+          result.cost as f64 / result.median / 1000000.0,
+          show_size(result.rss),
+          speedup,
+          compare,
+        );
+        results.push(result);
+      }
+    }
+    println!();
+  }
+
+  if let Some(path) = &opts.save {
+    save_baseline(path, &results)?;
+    println!("Saved to '{}'.", path);
+  }
+  if regressions > 0 {
+    return Err(format!("{} regression(s) above {}%.", regressions, opts.threshold));
+  }
+  Ok(())
+}
+
+// The given benchmarks, or every directory with a main.hvm
+fn bench_names(opts: &Options) -> Result<Vec<String>, String> {
+  if !opts.names.is_empty() {
+    return Ok(opts.names.clone());
+  }
+  let mut names = Vec::new();
+  let entries = std::fs::read_dir(&opts.dir).map_err(|err| format!("Can't read '{}': {}", opts.dir, err))?;
+  for entry in entries.flatten() {
+    if entry.path().join("main.hvm").is_file() {
+      names.push(entry.file_name().to_string_lossy().into_owned());
+    }
+  }
+  names.sort();
+  Ok(names)
+}
+
+// The inputs on the benchmark's `sizes` file, one per line. They're picked to run for a tenth of a
+// second or more on a single thread, so that the process start-up doesn't dominate the timings.
+fn default_sizes(dir: &Path) -> Vec<String> {
+  let text = std::fs::read_to_string(dir.join("sizes")).unwrap_or_default();
+  text.lines().map(|line| line.trim()).filter(|line| !line.is_empty()).map(String::from).collect()
+}
+
+// 1, 2, 4... up to the number of cores, and that number itself
+fn default_threads() -> Vec<usize> {
+  let cpus = num_cpus::get();
+  let mut threads = vec![];
+  let mut count = 1;
+  while count < cpus {
+    threads.push(count);
+    count *= 2;
+  }
+  threads.push(cpus);
+  threads
+}
+
+fn run_many(bin: &Path, name: &str, size: &str, threads: usize, opts: &Options) -> Result<Summary, String> {
+  let mut samples = Vec::new();
+  for _ in 0 .. opts.runs.max(1) {
+    samples.push(run_once(bin, size, threads, opts.heap_size)?);
+  }
+  let mut times: Vec<f64> = samples.iter().map(|sample| sample.time).collect();
+  times.sort_by(|a, b| a.partial_cmp(b).unwrap());
+  Ok(Summary {
+    name: name.to_string(),
+    size: size.to_string(),
+    threads,
+    median: percentile(&times, 0.5),
+    p10: percentile(&times, 0.1),
+    p90: percentile(&times, 0.9),
+    cost: samples[0].cost,
+    rss: samples.iter().map(|sample| sample.rss).max().unwrap_or(0),
+  })
+}
+
+// Nearest-rank percentile of sorted values
+fn percentile(sorted: &[f64], p: f64) -> f64 {
+  sorted[((sorted.len() - 1) as f64 * p).round() as usize]
+}
+
+fn run_once(bin: &Path, size: &str, threads: usize, heap_size: usize) -> Result<Sample, String> {
+  let start = std::time::Instant::now();
+  let mut child = std::process::Command::new(bin)
+    .args(["-T", &threads.to_string(), "-M", &heap_size.to_string(), "--", size])
+    .stdout(std::process::Stdio::null())
+    .stderr(std::process::Stdio::piped())
+    .spawn()
+    .map_err(|err| format!("Couldn't run '{}': {}", bin.display(), err))?;
+  let mut stats = String::new();
+  child.stderr.take().unwrap().read_to_string(&mut stats).map_err(|err| err.to_string())?;
+  let (ok, rss) = wait_child(child)?;
+  let time = start.elapsed().as_secs_f64();
+  if !ok {
+    return Err(format!("'{}' failed on input {}:\n{}", bin.display(), size, stats));
+  }
+  let cost = stats
+    .lines()
+    .find_map(|line| line.strip_prefix("Rewrites: "))
+    .and_then(|rest| rest.split_whitespace().next())
+    .and_then(|cost| cost.parse().ok())
+    .unwrap_or(0);
+  Ok(Sample { time, cost, rss })
+}
+
+// Waits for a child with wait4, which also reports its peak resident memory. Returns whether it
+// exited successfully, and that memory, in bytes.
+#[cfg(unix)]
+fn wait_child(child: std::process::Child) -> Result<(bool, u64), String> {
+  use std::os::raw::{c_int, c_long};
+
+  #[repr(C)]
+  #[allow(dead_code)]
+  struct RUsage {
+    utime: [c_long; 2],
+    stime: [c_long; 2],
+    maxrss: c_long,
+    rest: [c_long; 13],
+  }
+  extern "C" {
+    fn wait4(pid: c_int, status: *mut c_int, options: c_int, rusage: *mut RUsage) -> c_int;
+  }
+
+  let mut status: c_int = 0;
+  let mut usage: RUsage = unsafe { std::mem::zeroed() };
+  if unsafe { wait4(child.id() as c_int, &mut status, 0, &mut usage) } < 0 {
+    return Err(std::io::Error::last_os_error().to_string());
+  }
+  // Exited normally, with code 0. The peak memory is in KB, except on macOS.
+  let ok = status & 0xFFFF == 0;
+  let rss = if cfg!(target_os = "macos") { usage.maxrss as u64 } else { usage.maxrss as u64 * 1024 };
+  Ok((ok, rss))
+}
+
+#[cfg(not(unix))]
+fn wait_child(mut child: std::process::Child) -> Result<(bool, u64), String> {
+  let status = child.wait().map_err(|err| err.to_string())?;
+  Ok((status.success(), 0))
+}
+
+fn show_time(secs: f64) -> String {
+  if secs < 1.0 {
+    format!("{:.1} ms", secs * 1000.0)
+  } else {
+    format!("{:.3} s", secs)
+  }
+}
+
+fn show_size(bytes: u64) -> String {
+  format!("{:.1} MB", bytes as f64 / (1 << 20) as f64)
+}
+
+// Baseline files have one line per result: the benchmark, the size, the thread count and the
+// median wall time, in seconds, separated by tabs
+fn load_baseline(path: &str) -> Result<HashMap<Key, f64>, String> {
+  let text = std::fs::read_to_string(path).map_err(|err| format!("Can't read baseline '{}': {}", path, err))?;
+  let mut baseline = HashMap::new();
+  for line in text.lines().filter(|line| !line.trim().is_empty()) {
+    let cols: Vec<&str> = line.split('\t').collect();
+    let entry = match cols[..] {
+      [name, size, threads, median] => threads.parse().ok().zip(median.parse().ok()).map(|(t, m)| ((name, size, t), m)),
+      _ => None,
+    };
+    match entry {
+      Some(((name, size, threads), median)) => {
+        baseline.insert((name.to_string(), size.to_string(), threads), median);
+      }
+      None => {
+        return Err(format!("Invalid line on baseline '{}': {}", path, line));
+      }
+    }
+  }
+  Ok(baseline)
+}
+
+fn save_baseline(path: &str, results: &[Summary]) -> Result<(), String> {
+  let mut text = String::new();
+  for result in results {
+    text.push_str(&format!("{}\t{}\t{}\t{}\n", result.name, result.size, result.threads, result.median));
+  }
+  std::fs::write(path, text).map_err(|err| format!("Can't save baseline '{}': {}", path, err))
+}
+
+// Interactions
+// ------------
+
+// `hvm bench --rules` times single interactions, on both runtimes: it fills the heap with redexes
+// of one rule, rewrites them all, and divides the time by their count. The C side is rules.c,
+// linked to runtime.c, and mirrors `rule_make` and `rule_run` below. Rules that run inside
+// reduce() also pay for a reduce() call, so that cost, timed on numbers, is subtracted from theirs.
+
+const RULE_NAMES: &[&str] = &["reduce", "APP-LAM", "DUP-LAM", "DUP-SUP", "OP2-NUM", "FUN-SUP", "collect"];
+const RULE_CALL: usize = 0;
+const RULE_APP_LAM: usize = 1;
+const RULE_DUP_LAM: usize = 2;
+const RULE_DUP_SUP: usize = 3;
+const RULE_OP2_NUM: usize = 4;
+const RULE_FUN_SUP: usize = 5;
+const RULE_COLLECT: usize = 6;
+
+// Redexes per rule
+const RULE_REDEXES: u64 = 1 << 20;
+
+// A function id that is never called, and the label of the dups and sups
+const RULE_FID: u64 = 0x100;
+const RULE_COL: u64 = 1;
+
+fn run_rules(opts: &Options) -> Result<(), String> {
+  let bin = compiler::compile_rules()?;
+  let mut rs_times = vec![vec![]; RULE_NAMES.len()];
+  let mut c_times = vec![vec![]; RULE_NAMES.len()];
+  for _ in 0 .. opts.runs.max(1) {
+    for (rule, times) in rs_times.iter_mut().enumerate() {
+      times.push(rule_run(rule, RULE_REDEXES));
+    }
+    let output = std::process::Command::new(&bin)
+      .arg(RULE_REDEXES.to_string())
+      .output()
+      .map_err(|err| format!("Couldn't run '{}': {}", bin.display(), err))?;
+    for line in String::from_utf8_lossy(&output.stdout).lines() {
+      let (name, time) = line.rsplit_once(' ').ok_or_else(|| format!("Invalid output: {}", line))?;
+      let rule = RULE_NAMES.iter().position(|rule| *rule == name).ok_or_else(|| format!("Unknown rule: {}", name))?;
+      c_times[rule].push(time.parse::<f64>().map_err(|err| err.to_string())?);
+    }
+  }
+
+  // Medians, minus the reduce() call where it applies
+  let medians = |times: &mut Vec<Vec<f64>>| -> Vec<f64> {
+    let mut medians: Vec<f64> = times
+      .iter_mut()
+      .map(|times| {
+        times.sort_by(|a, b| a.partial_cmp(b).unwrap());
+        percentile(times, 0.5)
+      })
+      .collect();
+    for rule in RULE_APP_LAM ..= RULE_OP2_NUM {
+      medians[rule] = (medians[rule] - medians[RULE_CALL]).max(0.0);
+    }
+    medians
+  };
+  let rs_medians = medians(&mut rs_times);
+  let c_medians = medians(&mut c_times);
+
+  println!("Nanoseconds per interaction, median of {} runs over {} redexes", opts.runs.max(1), RULE_REDEXES);
+  println!("{:>10} {:>12} {:>12}", "rule", "runtime.rs", "runtime.c");
+  for (rule, name) in RULE_NAMES.iter().enumerate() {
+    println!("{:>10} {:>12.2} {:>12.2}", name, rs_medians[rule], c_medians[rule]);
+  }
+  Ok(())
+}
+
+// λx(x)
+fn rule_id(mem: &mut rt::Worker) -> rt::Ptr {
+  let lam = rt::alloc(mem, 2);
+  rt::link(mem, lam + 1, rt::Var(lam));
+  rt::Lam(lam)
+}
+
+// Builds a redex of the given rule, to be stored on a host
+fn rule_make(mem: &mut rt::Worker, rule: usize) -> rt::Ptr {
+  match rule {
+    // 0
+    RULE_CALL => rt::Num(0),
+    // (λx(x) 1)
+    RULE_APP_LAM => {
+      let app = rt::alloc(mem, 2);
+      let lam = rule_id(mem);
+      rt::link(mem, app + 0, lam);
+      rt::link(mem, app + 1, rt::Num(1));
+      rt::App(app)
+    }
+    // dup a ~ = λx(x); a
+    RULE_DUP_LAM => {
+      let dup = rt::alloc(mem, 3);
+      let lam = rule_id(mem);
+      rt::link(mem, dup + 1, rt::Era());
+      rt::link(mem, dup + 2, lam);
+      rt::Dp0(RULE_COL, dup)
+    }
+    // dup a ~ = {1 2}; a
+    RULE_DUP_SUP => {
+      let dup = rt::alloc(mem, 3);
+      let par = rt::alloc(mem, 2);
+      rt::link(mem, par + 0, rt::Num(1));
+      rt::link(mem, par + 1, rt::Num(2));
+      rt::link(mem, dup + 1, rt::Era());
+      rt::link(mem, dup + 2, rt::Par(RULE_COL, par));
+      rt::Dp0(RULE_COL, dup)
+    }
+    // (+ 2 3)
+    RULE_OP2_NUM => {
+      let op2 = rt::alloc(mem, 2);
+      rt::link(mem, op2 + 0, rt::Num(2));
+      rt::link(mem, op2 + 1, rt::Num(3));
+      rt::Op2(rt::ADD, op2)
+    }
+    // (F {1 2} 3)
+    RULE_FUN_SUP => {
+      let fun = rt::alloc(mem, 2);
+      let par = rt::alloc(mem, 2);
+      rt::link(mem, par + 0, rt::Num(1));
+      rt::link(mem, par + 1, rt::Num(2));
+      rt::link(mem, fun + 0, rt::Par(RULE_COL, par));
+      rt::link(mem, fun + 1, rt::Num(3));
+      rt::Cal(2, RULE_FID, fun)
+    }
+    // (K (K 1 2) λx(x)), which is collected
+    _ => {
+      let ctr0 = rt::alloc(mem, 2);
+      let ctr1 = rt::alloc(mem, 2);
+      let lam = rule_id(mem);
+      rt::link(mem, ctr1 + 0, rt::Num(1));
+      rt::link(mem, ctr1 + 1, rt::Num(2));
+      rt::link(mem, ctr0 + 0, rt::Ctr(2, RULE_FID, ctr1));
+      rt::link(mem, ctr0 + 1, lam);
+      rt::Ctr(2, RULE_FID, ctr0)
+    }
+  }
+}
+
+// Nanoseconds per rewrite of `n` redexes of a rule
+fn rule_run(rule: usize, n: u64) -> f64 {
+  let mut mem = rt::new_worker((n * 16) as usize);
+  let funs: rt::Funs = vec![];
+  let mut hosts = Vec::with_capacity(n as usize);
+  for _ in 0 .. n {
+    let host = rt::alloc(&mut mem, 1);
+    let term = rule_make(&mut mem, rule);
+    rt::link(&mut mem, host, term);
+    hosts.push(host);
+  }
+  let start = std::time::Instant::now();
+  for &host in &hosts {
+    let term = rt::ask_lnk(&mem, host);
+    match rule {
+      RULE_FUN_SUP => {
+        let argn = rt::ask_arg(&mem, term, 0);
+        rt::cal_par(&mut mem, host, term, argn, 0);
+      }
+      RULE_COLLECT => {
+        rt::collect(&mut mem, term);
+      }
+      _ => {
+        rt::reduce(&mut mem, &funs, host, None, false);
+      }
+    }
+  }
+  start.elapsed().as_nanos() as f64 / n as f64
+}
@@ -23,6 +23,7 @@ pub enum DynTerm {
   Cal { func: u64, args: Vec<DynTerm> },
   Ctr { func: u64, args: Vec<DynTerm> },
   Num { numb: u64 },
+  Flo { numb: u64 },
   Op2 { oper: u64, val0: Box<DynTerm>, val1: Box<DynTerm> },
 }
 
@@ -164,7 +165,7 @@ pub fn build_runtime_arities(rb: &rb::RuleBook) -> Vec<rt::Arity> {
           }
         }
       }
-      lang::Term::Num { .. } => {}
+      lang::Term::Num { .. } | lang::Term::Flo { .. } => {}
       lang::Term::Op2 { val0, val1, .. } => {
         find_arities(rb, aris, val0);
         find_arities(rb, aris, val1);
@@ -191,7 +192,7 @@ pub fn build_runtime_functions(book: &rb::RuleBook) -> Vec<Option<rt::Function>>
   funs[0] = Some(rt::Function {
     arity: 2,
     stricts: vec![],
-    rewriter: Box::new(move |rt, funs, _dups, host, term| {
+    rewriter: rt::Rewriter::Native(Box::new(move |rt, funs, _dups, host, term| {
       let msge = rt::get_loc(term,0);
       rt::normal(rt, funs, msge, Some(&i2n), false);
       println!("{}", rd::as_code(rt, Some(&i2n), msge));
@@ -199,7 +200,8 @@ pub fn build_runtime_functions(book: &rb::RuleBook) -> Vec<Option<rt::Function>>
       rt::clear(rt, rt::get_loc(term, 0), 2);
       rt::collect(rt, rt::ask_lnk(rt, msge));
       return true;
-    }),
+    })),
+    jitted: std::cell::Cell::new(None),
   });
   // The put function. Like HVM.log, but optimized for strings.
   // FIXME: implement and use a specialized readback_string function
@@ -207,7 +209,7 @@ pub fn build_runtime_functions(book: &rb::RuleBook) -> Vec<Option<rt::Function>>
   funs[1] = Some(rt::Function {
     arity: 2,
     stricts: vec![],
-    rewriter: Box::new(move |rt, funs, _dups, host, term| {
+    rewriter: rt::Rewriter::Native(Box::new(move |rt, funs, _dups, host, term| {
       let msge = rt::get_loc(term,0);
       rt::normal(rt, funs, msge, Some(&i2n), false);
       let code = rd::as_code(rt, Some(&i2n), msge);
@@ -220,7 +222,8 @@ pub fn build_runtime_functions(book: &rb::RuleBook) -> Vec<Option<rt::Function>>
       rt::clear(rt, rt::get_loc(term, 0), 2);
       rt::collect(rt, rt::ask_lnk(rt, msge));
       return true;
-    }),
+    })),
+    jitted: std::cell::Cell::new(None),
   });
   // Creates all the other functions
   for (name, rules_info) in &book.rule_group {
@@ -242,105 +245,117 @@ pub fn build_runtime_function(book: &rb::RuleBook, fn_name: &str, rules: &[lang:
     }
   }
 
-  let rewriter: rt::Rewriter = Box::new(move |mem, _funs, dups, host, term| {
-    // For each argument, if it is a redex and a SUP, apply the cal_par rule
-    for (i, redex) in dynfun.redex.iter().enumerate() {
-      let i = i as u64;
-      if *redex && rt::get_tag(rt::ask_arg(mem, term, i)) == rt::SUP {
-        rt::cal_par(mem, host, term, rt::ask_arg(mem, term, i), i);
-        return true;
-      }
-    }
-
-    // For each rule condition vector
-    for (r, dynrule) in dynfun.rules.iter().enumerate() {
-      // Check if the rule matches
-      let mut matched = true;
-
-      // Tests each rule condition (ex: `get_tag(args[0]) == SUCC`)
-      for (i, cond) in dynrule.cond.iter().enumerate() {
-        let i = i as u64;
-        match rt::get_tag(*cond) {
-          rt::NUM => {
-            //println!("Didn't match because of NUM. i={} {} {}", i, rt::get_num(rt::ask_arg(mem, term, i)), rt::get_num(*cond));
-            let same_tag = rt::get_tag(rt::ask_arg(mem, term, i)) == rt::NUM;
-            let same_val = rt::get_num(rt::ask_arg(mem, term, i)) == rt::get_num(*cond);
-            matched = matched && same_tag && same_val;
-          }
-          rt::CTR => {
-            //println!("Didn't match because of CTR. i={} {} {}", i, rt::get_tag(rt::ask_arg(mem, term, i)), rt::get_ext(*cond));
-            let same_tag = rt::get_tag(rt::ask_arg(mem, term, i)) == rt::CTR;
-            let same_ext = rt::get_ext(rt::ask_arg(mem, term, i)) == rt::get_ext(*cond);
-            matched = matched && same_tag && same_ext;
-          }
-          rt::VAR => {
-            // If this is a strict argument, then we're in a default variable
-            if dynfun.redex[i as usize] {
+  let rewriter = rt::Rewriter::Bytecode(build_bytecode(&dynfun));
 
-              // This is a Kind2-specific optimization. Check 'HOAS_OPT'.
-              if dynrule.hoas && r != dynfun.rules.len() - 1 {
+  rt::Function { arity, stricts, rewriter, jitted: std::cell::Cell::new(None) }
+}
 
-                // Matches number literals
-                let is_num
-                  = rt::get_tag(rt::ask_arg(mem, term, i)) == rt::NUM;
+/// Compiles the rules of a function to the bytecode run by `rt::rewrite`. Each rule becomes its
+/// match tests, followed by the loads of its variables, the allocation and filling of the nodes of
+/// its pre-filled body, and the clean-up of the matched constructors.
+pub fn build_bytecode(dynfun: &DynFun) -> Vec<u64> {
+  // Converts an element to the `v t m` operands, or returns the register of an external variable
+  fn operands(elem: &Elem, base: u64) -> Result<[u64; 3], u64> {
+    match elem {
+      Elem::Fix { value } => Ok([*value, 0, 0]),
+      Elem::Ext { index } => Err(1 + index),
+      Elem::Loc { value, targ, slot } => {
+        let is_dup = rt::get_tag(*value) == rt::DP0 || rt::get_tag(*value) == rt::DP1;
+        Ok([value + slot, base + targ, if is_dup { u64::MAX } else { 0 }])
+      }
+    }
+  }
 
-                // Matches constructor labels
-                let is_ctr
-                  =  rt::get_tag(rt::ask_arg(mem, term, i)) == rt::CTR
-                  && rt::ask_ari(mem, rt::ask_arg(mem, term, i)) == 0;
+  let mut code = vec![0];
+  let mut regs = 1;
 
-                // Matches HOAS numbers and constructors
-                let is_hoas_ctr_num
-                  =  rt::get_tag(rt::ask_arg(mem, term, i)) == rt::CTR
-                  && rt::get_ext(rt::ask_arg(mem, term, i)) >= rt::HOAS_CT0
-                  && rt::get_ext(rt::ask_arg(mem, term, i)) <= rt::HOAS_NUM;
+  // For each argument, if it is a redex and a SUP, apply the cal_par rule
+  for (i, redex) in dynfun.redex.iter().enumerate() {
+    if *redex {
+      code.extend([rt::OP_PAR, i as u64]);
+    }
+  }
 
-                matched = matched && (is_num || is_ctr || is_hoas_ctr_num);
+  for (r, dynrule) in dynfun.rules.iter().enumerate() {
+    code.extend([rt::OP_RULE, 0]);
+    let next = code.len() - 1;
 
-              // Only match default variables on CTRs and NUMs
-              } else {
-                let is_ctr = rt::get_tag(rt::ask_arg(mem, term, i)) == rt::CTR;
-                let is_num = rt::get_tag(rt::ask_arg(mem, term, i)) == rt::NUM;
-                matched = matched && (is_ctr || is_num);
-              }
-            }
+    // Tests each rule condition (ex: `get_tag(args[0]) == SUCC`)
+    for (i, cond) in dynrule.cond.iter().enumerate() {
+      let i = i as u64;
+      match rt::get_tag(*cond) {
+        rt::NUM => code.extend([rt::OP_NUM, i, rt::get_num(*cond)]),
+        rt::CTR => code.extend([rt::OP_CTR, i, rt::get_fun(*cond)]),
+        // If this is a strict argument, then we're in a default variable
+        rt::VAR if dynfun.redex[i as usize] => {
+          // This is a Kind2-specific optimization. Check 'HOAS_OPT'.
+          if dynrule.hoas && r != dynfun.rules.len() - 1 {
+            code.extend([rt::OP_HOAS, i]);
+          // Only match default variables on CTRs, NUMs and FLOs
+          } else {
+            code.extend([rt::OP_VAL, i]);
           }
-          _ => {}
         }
+        _ => {}
       }
+    }
 
-      // If all conditions are satisfied, the rule matched, so we must apply it
-      if matched {
-        // Increments the gas count
-        rt::inc_cost(mem);
-
-        // Builds the right-hand side term (ex: `(Succ (Add a b))`)
-        let done = alloc_body(mem, term, &dynrule.vars, dups, &dynrule.body);
-
-        // Links the host location to it
-        rt::link(mem, host, done);
-
-        // Clears the matched ctrs (the `(Succ ...)` and the `(Add ...)` ctrs)
-        rt::clear(mem, rt::get_loc(term, 0), dynfun.redex.len() as u64);
-        for (i, arity) in &dynrule.free {
-          let i = *i as u64;
-          rt::clear(mem, rt::get_loc(rt::ask_arg(mem, term, i), 0), *arity);
-        }
+    // Loads the matched variables to the registers after the 0
+    if !dynrule.vars.is_empty() {
+      code.extend([rt::OP_LOAD, dynrule.vars.len() as u64]);
+      for DynVar { param, field, erase: _ } in &dynrule.vars {
+        code.extend([*param, field.map_or(0, |j| j + 1)]);
+      }
+    }
 
-        // Collects unused variables (none in this example)
-        for dynvar @ DynVar { param: _, field: _, erase } in dynrule.vars.iter() {
-          if *erase {
-            rt::collect(mem, get_var(mem, term, dynvar));
+    // Builds the right-hand side term (ex: `(Succ (Add a b))`), with its nodes after the variables
+    let (elem, nodes, dupk) = &dynrule.body;
+    let base = 1 + dynrule.vars.len() as u64;
+    if !nodes.is_empty() {
+      code.extend([rt::OP_ALLOC, base, nodes.len() as u64]);
+      code.extend(nodes.iter().map(|node| node.len() as u64));
+      let mut body = vec![];
+      let mut exts = vec![];
+      for (k, node) in nodes.iter().enumerate() {
+        for (j, elem) in node.iter().enumerate() {
+          match operands(elem, base) {
+            Ok(oprs) => body.extend([base + k as u64, j as u64, oprs[0], oprs[1], oprs[2]]),
+            Err(var) => exts.extend([rt::OP_EXT, base + k as u64, j as u64, var]),
           }
         }
+      }
+      code.extend([rt::OP_BODY, body.len() as u64 / 5]);
+      code.extend(body);
+      code.extend(exts);
+    }
 
-        return true;
+    // Links the host location to it
+    match operands(elem, base) {
+      Ok(oprs) => code.extend([rt::OP_RET, oprs[0], oprs[1], oprs[2]]),
+      Err(var) => code.extend([rt::OP_RET, 0, var, 0]),
+    }
+
+    // Clears the matched ctrs (the `(Succ ...)` and the `(Add ...)` ctrs)
+    code.extend([rt::OP_CLEAR, dynfun.redex.len() as u64]);
+    for (i, arity) in &dynrule.free {
+      code.extend([rt::OP_FREE, *i, *arity]);
+    }
+
+    // Collects unused variables (none in this example)
+    for (k, dynvar) in dynrule.vars.iter().enumerate() {
+      if dynvar.erase {
+        code.extend([rt::OP_COLLECT, 1 + k as u64]);
       }
     }
-    false
-  });
 
-  rt::Function { arity, stricts, rewriter }
+    code.extend([rt::OP_DONE, *dupk]);
+    code[next] = code.len() as u64;
+    regs = std::cmp::max(regs, base + nodes.len() as u64);
+  }
+
+  code.push(rt::OP_FAIL);
+  code[0] = regs;
+  code
 }
 
 /// Converts a language Term to a runtime Term
@@ -422,6 +437,7 @@ pub fn term_to_dynterm(book: &rb::RuleBook, term: &lang::Term, inps: &[String])
         }
       }
       lang::Term::Num { numb } => DynTerm::Num { numb: *numb },
+      lang::Term::Flo { numb } => DynTerm::Flo { numb: *numb },
       lang::Term::Op2 { oper, val0, val1 } => {
         let oper = convert_oper(oper);
         let val0 = Box::new(convert_term(val0, book, depth + 0, vars));
@@ -547,6 +563,7 @@ pub fn build_body(term: &DynTerm, free_vars: u64) -> Body {
         }
       }
       DynTerm::Num { numb } => Elem::Fix { value: rt::Num(*numb as u64) },
+      DynTerm::Flo { numb } => Elem::Fix { value: rt::Flo(*numb) },
       DynTerm::Op2 { oper, val0, val1 } => {
         let targ = nodes.len() as u64;
         nodes.push(vec![Elem::Fix { value: 0 }; 2]);
@@ -649,14 +666,29 @@ pub fn eval_code(
   code: &str,
   debug: bool,
   size: usize,
+) -> Result<(String, u64, u64, u64), String> {
+  eval_code_with_tiers(call, code, debug, false, size)
+}
+
+// Evaluates a HVM term to normal form, compiling hot functions to native code if `tiered` is set
+pub fn eval_code_with_tiers(
+  call: &lang::Term,
+  code: &str,
+  debug: bool,
+  tiered: bool,
+  size: usize,
 ) -> Result<(String, u64, u64, u64), String> {
   let mut worker = rt::new_worker(size);
+  if tiered {
+    worker.tiers = Some(rt::new_tiers());
+  }
 
   // Parses and reads the input file
   let file = lang::read_file(code)?;
 
   // Converts the HVM "file" to a Rulebook
   let book = rb::gen_rulebook(&file);
+  rb::check_rulebook(&book)?;
 
   // Builds functions
   let funs = build_runtime_functions(&book);
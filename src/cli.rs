@@ -17,7 +17,16 @@ pub struct Cli {
 pub enum Command {
   /// Run a file interpreted
   #[clap(aliases = &["r"])]
-  Run { file: String, params: Vec<String> },
+  Run {
+    file: String,
+    params: Vec<String>,
+    #[clap(long)]
+    /// Compile to native code (cached), and run that instead
+    native: bool,
+    #[clap(long)]
+    /// Compile hot functions to native code in the background, while interpreting
+    tiered: bool,
+  },
 
   /// Run in debug mode
   #[clap(aliases = &["d"])]
@@ -31,6 +40,36 @@ pub enum Command {
     /// Disable multi-threading
     single_thread: bool,
   },
+
+  /// Benchmark the compiled programs on bench/*/main.hvm
+  Bench {
+    /// Benchmarks to run (default: all of them)
+    names: Vec<String>,
+    #[clap(long, default_value = "bench")]
+    /// Directory with a subdirectory per benchmark
+    dir: String,
+    #[clap(long, value_delimiter = ',')]
+    /// Inputs of Main (default: those on each benchmark's sizes file)
+    sizes: Vec<String>,
+    #[clap(long, value_delimiter = ',')]
+    /// Thread counts (default: 1, 2, 4... up to the number of cores)
+    threads: Vec<usize>,
+    #[clap(long, default_value = "5")]
+    /// Runs of each benchmark, size and thread count
+    runs: usize,
+    #[clap(long)]
+    /// Compare the medians against a file saved with --save
+    baseline: Option<String>,
+    #[clap(long)]
+    /// Save the medians to a file
+    save: Option<String>,
+    #[clap(long, default_value = "5")]
+    /// Flag medians that are slower than the baseline by more than this percentage
+    threshold: f64,
+    #[clap(long)]
+    /// Time single interactions instead, on both runtimes
+    rules: bool,
+  },
 }
 
 fn get_unit_ratio(unit: &str) -> Option<usize> {
@@ -1,7 +1,7 @@
 #![allow(clippy::identity_op)]
 
 use regex::Regex;
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 use std::io::Write;
 
 use crate::builder as bd;
@@ -25,10 +25,360 @@ pub fn compile_code_and_save(code: &str, file_name: &str, heap_size: usize, para
 fn compile_code(code: &str, heap_size: usize, parallel: bool) -> Result<String, String> {
   let file = lang::read_file(code)?;
   let book = rb::gen_rulebook(&file);
+  rb::check_rulebook(&book)?;
   bd::build_runtime_functions(&book);
   Ok(compile_book(&book, heap_size, parallel))
 }
 
+// Native
+// ------
+
+// `hvm run --native` builds the generated C as a shared object, with the C compiler on `$CC` (or
+// `clang`), and runs its `main` in this process. Builds are cached under `$XDG_CACHE_HOME/hvm`,
+// keyed by a hash of the rulebook and of this code generator, so unchanged programs skip the C
+// compiler on later runs, and builds of older hvm versions are never reused.
+// Tiered execution (see 'Tiers' on runtime.rs) builds and loads single functions the same way.
+
+// The heap size baked into native builds; `run_native` passes the actual one with `-M`
+const NATIVE_HEAP_SIZE: usize = 4 << 30;
+
+// Flags for the C compiler. `-Bsymbolic` binds the runtime's calls to its own functions, instead
+// of to the libc ones with the same names (like `link`) that are already loaded in this process,
+// and `-fno-semantic-interposition` lets them be inlined despite `-fPIC`.
+const NATIVE_CFLAGS: &[&str] =
+  &["-O2", "-shared", "-fPIC", "-fno-semantic-interposition", "-Wl,-Bsymbolic", "-pthread"];
+
+/// Compiles a file to a shared object, or finds it on the cache. Returns its path.
+pub fn compile_native(code: &str, parallel: bool) -> Result<std::path::PathBuf, String> {
+  let file = lang::read_file(code)?;
+  let book = rb::gen_rulebook(&file);
+  rb::check_rulebook(&book)?;
+  let path = native_cache_dir().join(format!("{:016x}.so", hash_book(&book, parallel)));
+  if !path.exists() {
+    eprintln!("Compiling to '{}'.", path.display());
+    bd::build_runtime_functions(&book);
+    build_c(&compile_book(&book, NATIVE_HEAP_SIZE, parallel), NATIVE_CFLAGS, &path)?;
+  }
+  Ok(path)
+}
+
+// Flags for standalone binaries, as suggested on the README
+const BINARY_CFLAGS: &[&str] = &["-O2", "-pthread"];
+
+/// Compiles a file to an executable, like `hvm c` followed by `clang`, or finds it on the cache.
+/// Returns its path. It takes the same options as a binary built by hand.
+pub fn compile_binary(code: &str, parallel: bool) -> Result<std::path::PathBuf, String> {
+  let file = lang::read_file(code)?;
+  let book = rb::gen_rulebook(&file);
+  rb::check_rulebook(&book)?;
+  let hash = bd::hash(&(hash_book(&book, parallel), BINARY_CFLAGS));
+  let path = native_cache_dir().join(format!("{:016x}.bin", hash));
+  if !path.exists() {
+    eprintln!("Compiling to '{}'.", path.display());
+    bd::build_runtime_functions(&book);
+    build_c(&compile_book(&book, NATIVE_HEAP_SIZE, parallel), BINARY_CFLAGS, &path)?;
+  }
+  Ok(path)
+}
+
+/// Builds the interaction microbenchmarks of rules.c, linked to the runtime, or finds them on the
+/// cache. Returns the path of the executable.
+pub fn compile_rules() -> Result<std::path::PathBuf, String> {
+  let as_clang = format!(
+    "#define PARALLEL\n#define main hvm_main\n{}\n#undef main\n{}",
+    C_RUNTIME_TEMPLATE, C_RULES_TEMPLATE
+  );
+  let path = native_cache_dir().join(format!("{:016x}.bin", bd::hash(&(BINARY_CFLAGS, &as_clang))));
+  if !path.exists() {
+    eprintln!("Compiling to '{}'.", path.display());
+    build_c(&as_clang, BINARY_CFLAGS, &path)?;
+  }
+  Ok(path)
+}
+
+/// Loads a shared object built by `compile_native` and runs it on the given args, which are
+/// passed to its `main` as on the command line of a compiled binary.
+pub fn run_native(path: &std::path::Path, heap_size: usize, params: &[String]) -> Result<(), String> {
+  use std::ffi::CString;
+  use std::os::raw::{c_char, c_int, c_void};
+
+  extern "C" {
+    fn fflush(stream: *mut c_void) -> c_int;
+  }
+
+  let mut args = vec!["hvm".to_string(), "-M".to_string(), heap_size.to_string(), "--".to_string()];
+  args.extend(params.iter().cloned());
+  let args: Vec<CString> = args.into_iter().map(|arg| CString::new(arg).unwrap()).collect();
+  let mut argv: Vec<*const c_char> = args.iter().map(|arg| arg.as_ptr()).collect();
+  argv.push(std::ptr::null());
+
+  unsafe {
+    let main = load_symbol(path, "main")?;
+    let main: extern "C" fn(c_int, *const *const c_char) -> c_int = std::mem::transmute(main);
+    let code = main(args.len() as c_int, argv.as_ptr());
+    fflush(std::ptr::null_mut());
+    if code != 0 {
+      return Err(format!("Native run failed with code {}.", code));
+    }
+  }
+  Ok(())
+}
+
+/// Builds the bytecode of a function (see 'Bytecode' on runtime.rs) as a native `rt::Jitted`
+/// rewriter, or finds it on the cache. Returns its address.
+pub fn build_rewriter(code: &[u64]) -> Result<usize, String> {
+  let as_clang = compile_rewriter(code);
+  let path = native_cache_dir().join(format!("{:016x}.so", bd::hash(&(NATIVE_CFLAGS, &as_clang))));
+  if !path.exists() {
+    build_c(&as_clang, NATIVE_CFLAGS, &path)?;
+  }
+  load_symbol(&path, "rewrite")
+}
+
+// Translates the bytecode of a function to a C function with the same effect as `rt::rewrite`.
+// Operands become constants, and the heap is accessed directly, through the `rt::JitCtx`.
+fn compile_rewriter(code: &[u64]) -> String {
+  let mut c = String::new();
+  line(&mut c, 0, "#include <stdint.h>");
+  line(&mut c, 0, "typedef uint64_t u64;");
+  line(&mut c, 0, "typedef uint8_t u8;");
+  line(&mut c, 0, "typedef struct {");
+  line(&mut c, 1, "u64* node;");
+  line(&mut c, 1, "u64* cost;");
+  line(&mut c, 1, "u64* dups;");
+  line(&mut c, 1, "void* mem;");
+  line(&mut c, 1, "u64 (*alloc)(void* mem, u64 size);");
+  line(&mut c, 1, "void (*clear)(void* mem, u64 loc, u64 size);");
+  line(&mut c, 1, "void (*collect)(void* mem, u64 term);");
+  line(&mut c, 1, "void (*cal_par)(void* mem, u64 host, u64 term, u64 argn, u64 n);");
+  line(&mut c, 0, "} Ctx;");
+  line(&mut c, 0, &format!("#define TAG(x) ((x) / {}ull)", rt::TAG));
+  line(&mut c, 0, &format!("#define LOC(x, i) (((x) & {}ull) + (i))", rt::VAL_MASK));
+  line(&mut c, 0, &format!("#define FUN(x) (((x) / {}ull) & 0xFFFF)", rt::EXT));
+  line(&mut c, 0, &format!("#define ARI(x) (((x) / {}ull) & 0xFF)", rt::ARI));
+  line(&mut c, 0, &format!("#define NUM(x) ((x) & {}ull)", rt::NUM_MASK));
+  line(&mut c, 0, "#define ARG(x, i) (node[LOC(x, i)])");
+  line(&mut c, 0, "static inline void link(u64* node, u64 loc, u64 lnk) {");
+  line(&mut c, 1, "node[loc] = lnk;");
+  line(&mut c, 1, &format!("if (TAG(lnk) <= {}) {{", rt::VAR));
+  line(&mut c, 2, &format!("node[LOC(lnk, TAG(lnk) & 1)] = {}ull | loc;", rt::Arg(0)));
+  line(&mut c, 1, "}");
+  line(&mut c, 0, "}");
+  line(&mut c, 0, "u8 rewrite(Ctx* ctx, u64 host, u64 term) {");
+  line(&mut c, 1, "u64* node = ctx->node;");
+  line(&mut c, 1, &format!("u64 dupx = (*ctx->dups & 0xFFFFFF) * {}ull;", rt::EXT));
+  line(&mut c, 1, &format!("u64 r[{}] = {{0}};", std::cmp::max(code[0], 1)));
+  line(&mut c, 1, "u64 arg;");
+
+  // The `v + r[t] + (dupx & m)` value of an instruction, folding the parts known to be zero
+  fn value(v: u64, t: u64, m: u64) -> String {
+    let mut value = format!("{:#x}ull", v);
+    if t != 0 {
+      value += &format!(" + r[{}]", t);
+    }
+    if m != 0 {
+      value += " + dupx";
+    }
+    value
+  }
+
+  let mut pc = 1;
+  let mut next = 0;
+  while pc < code.len() {
+    let word = |k: usize| code[pc + k];
+    match word(0) {
+      rt::OP_PAR => {
+        line(&mut c, 1, &format!("arg = ARG(term, {});", word(1)));
+        line(&mut c, 1, &format!("if (TAG(arg) == {}) {{", rt::SUP));
+        line(&mut c, 2, &format!("ctx->cal_par(ctx->mem, host, term, arg, {});", word(1)));
+        line(&mut c, 2, "return 1;");
+        line(&mut c, 1, "}");
+        pc += 2;
+      }
+      rt::OP_RULE => {
+        line(&mut c, 0, &format!("L{}:;", pc));
+        next = word(1);
+        pc += 2;
+      }
+      rt::OP_NUM => {
+        line(&mut c, 1, &format!("arg = ARG(term, {});", word(1)));
+        let cond = format!("TAG(arg) == {} && NUM(arg) == {}ull", rt::NUM, word(2));
+        line(&mut c, 1, &format!("if (!({})) goto L{};", cond, next));
+        pc += 3;
+      }
+      rt::OP_CTR => {
+        line(&mut c, 1, &format!("arg = ARG(term, {});", word(1)));
+        let cond = format!("TAG(arg) == {} && FUN(arg) == {}", rt::CTR, word(2));
+        line(&mut c, 1, &format!("if (!({})) goto L{};", cond, next));
+        pc += 3;
+      }
+      rt::OP_VAL => {
+        line(&mut c, 1, &format!("arg = ARG(term, {});", word(1)));
+        let cond = format!("TAG(arg) == {} || TAG(arg) == {} || TAG(arg) == {}", rt::CTR, rt::NUM, rt::FLO);
+        line(&mut c, 1, &format!("if (!({})) goto L{};", cond, next));
+        pc += 2;
+      }
+      rt::OP_HOAS => {
+        line(&mut c, 1, &format!("arg = ARG(term, {});", word(1)));
+        let is_num = format!("TAG(arg) == {} || TAG(arg) == {}", rt::NUM, rt::FLO);
+        let is_ctr = format!("TAG(arg) == {} && ARI(arg) == 0", rt::CTR);
+        let is_hoas = format!("TAG(arg) == {} && FUN(arg) >= {} && FUN(arg) <= {}", rt::CTR, rt::HOAS_CT0, rt::HOAS_NUM);
+        line(&mut c, 1, &format!("if (!({} || {} || {})) goto L{};", is_num, is_ctr, is_hoas, next));
+        pc += 2;
+      }
+      rt::OP_LOAD => {
+        let size = word(1) as usize;
+        for k in 0 .. size {
+          let (i, j) = (word(2 + k * 2), word(3 + k * 2));
+          if j == 0 {
+            line(&mut c, 1, &format!("r[{}] = ARG(term, {});", 1 + k, i));
+          } else {
+            line(&mut c, 1, &format!("r[{}] = ARG(ARG(term, {}), {});", 1 + k, i, j - 1));
+          }
+        }
+        pc += 2 + size * 2;
+      }
+      rt::OP_ALLOC => {
+        let (base, size) = (word(1), word(2) as usize);
+        for k in 0 .. size {
+          line(&mut c, 1, &format!("r[{}] = ctx->alloc(ctx->mem, {});", base + k as u64, word(3 + k)));
+        }
+        pc += 3 + size;
+      }
+      rt::OP_BODY => {
+        let size = word(1) as usize;
+        for k in 0 .. size {
+          let elem = |i: usize| code[pc + 2 + k * 5 + i];
+          line(&mut c, 1, &format!("node[r[{}] + {}] = {};", elem(0), elem(1), value(elem(2), elem(3), elem(4))));
+        }
+        pc += 2 + size * 5;
+      }
+      rt::OP_EXT => {
+        line(&mut c, 1, &format!("link(node, r[{}] + {}, r[{}]);", word(1), word(2), word(3)));
+        pc += 4;
+      }
+      rt::OP_RET => {
+        line(&mut c, 1, &format!("link(node, host, {});", value(word(1), word(2), word(3))));
+        pc += 4;
+      }
+      rt::OP_CLEAR => {
+        line(&mut c, 1, "*ctx->cost += 1;");
+        line(&mut c, 1, &format!("ctx->clear(ctx->mem, LOC(term, 0), {});", word(1)));
+        pc += 2;
+      }
+      rt::OP_FREE => {
+        line(&mut c, 1, &format!("ctx->clear(ctx->mem, LOC(ARG(term, {}), 0), {});", word(1), word(2)));
+        pc += 3;
+      }
+      rt::OP_COLLECT => {
+        line(&mut c, 1, &format!("ctx->collect(ctx->mem, r[{}]);", word(1)));
+        pc += 2;
+      }
+      rt::OP_DONE => {
+        line(&mut c, 1, &format!("*ctx->dups += {};", word(1)));
+        line(&mut c, 1, "return 1;");
+        pc += 2;
+      }
+      _ => {
+        line(&mut c, 0, &format!("L{}:;", pc));
+        line(&mut c, 1, "return 0;");
+        pc += 1;
+      }
+    }
+  }
+  line(&mut c, 0, "}");
+  c
+}
+
+// Builds C code with the given flags, to the given path. It is built next to it, then renamed, so
+// that concurrent runs never see a partial build.
+fn build_c(as_clang: &str, flags: &[&str], path: &std::path::Path) -> Result<(), String> {
+  if let Some(dir) = path.parent() {
+    std::fs::create_dir_all(dir).map_err(|err| err.to_string())?;
+  }
+  let c_path = path.with_extension(format!("{}.c", std::process::id()));
+  let out_path = path.with_extension(format!("{}.out", std::process::id()));
+  std::fs::write(&c_path, as_clang).map_err(|err| err.to_string())?;
+  let cc = std::env::var("CC").unwrap_or_else(|_| "clang".to_string());
+  let status = std::process::Command::new(&cc)
+    .args(flags)
+    .arg("-o")
+    .arg(&out_path)
+    .arg(&c_path)
+    .status();
+  std::fs::remove_file(&c_path).ok();
+  match status {
+    Ok(status) if status.success() => {}
+    Ok(_) => return Err(format!("Couldn't compile to '{}'.", path.display())),
+    Err(err) => return Err(format!("Couldn't run the C compiler '{}': {}", cc, err)),
+  }
+  std::fs::rename(&out_path, path).map_err(|err| err.to_string())
+}
+
+// Loads a shared object, and returns the address of one of its symbols. It is never unloaded.
+#[cfg(unix)]
+fn load_symbol(path: &std::path::Path, name: &str) -> Result<usize, String> {
+  use std::ffi::{CStr, CString};
+  use std::os::raw::{c_char, c_int, c_void};
+  use std::os::unix::ffi::OsStrExt;
+
+  const RTLD_NOW: c_int = 2;
+  #[link(name = "dl")]
+  extern "C" {
+    fn dlopen(filename: *const c_char, flag: c_int) -> *mut c_void;
+    fn dlsym(handle: *mut c_void, symbol: *const c_char) -> *mut c_void;
+    fn dlerror() -> *const c_char;
+  }
+
+  unsafe {
+    let file = CString::new(path.as_os_str().as_bytes()).unwrap();
+    let handle = dlopen(file.as_ptr(), RTLD_NOW);
+    if handle.is_null() {
+      return Err(CStr::from_ptr(dlerror()).to_string_lossy().into_owned());
+    }
+    let name = CString::new(name).unwrap();
+    let symbol = dlsym(handle, name.as_ptr());
+    if symbol.is_null() {
+      return Err(CStr::from_ptr(dlerror()).to_string_lossy().into_owned());
+    }
+    Ok(symbol as usize)
+  }
+}
+
+#[cfg(not(unix))]
+fn load_symbol(_path: &std::path::Path, _name: &str) -> Result<usize, String> {
+  Err("Native code is only supported on Unix.".to_string())
+}
+
+fn native_cache_dir() -> std::path::PathBuf {
+  if let Some(dir) = std::env::var_os("XDG_CACHE_HOME") {
+    std::path::PathBuf::from(dir).join("hvm")
+  } else if let Some(dir) = std::env::var_os("HOME") {
+    std::path::PathBuf::from(dir).join(".cache").join("hvm")
+  } else {
+    std::env::temp_dir().join("hvm")
+  }
+}
+
+// Hashes everything the C code depends on. The rulebook's maps are sorted first, since their
+// iteration order changes from run to run, and so do the ids it assigns to names. These are left
+// out: the compiled program parses its args and prints its result by name, so they don't matter.
+// Rules are kept in source order within each function, since the first one that matches wins.
+fn hash_book(book: &rb::RuleBook, parallel: bool) -> u64 {
+  let mut names: Vec<&String> = book.id_to_name.values().collect();
+  let mut rules: Vec<(&String, Vec<String>)> = book
+    .rule_group
+    .iter()
+    .map(|(name, (_arity, rules))| (name, rules.iter().map(|rule| format!("{}", rule)).collect()))
+    .collect();
+  let mut calls: Vec<(&String, &bool)> = book.ctr_is_cal.iter().collect();
+  names.sort();
+  rules.sort();
+  calls.sort();
+  let generator = (env!("CARGO_PKG_VERSION"), C_COMPILER_SOURCE, C_RUNTIME_TEMPLATE);
+  bd::hash(&(names, rules, calls, parallel, num_cpus::get(), NATIVE_CFLAGS, generator))
+}
+
 fn compile_name(name: &str) -> String {
   // TODO: this can still cause some name collisions.
   // Note: avoiding the use of `$` because it is not an actually valid
@@ -44,6 +394,20 @@ fn compile_book(comp: &rb::RuleBook, heap_size: usize, parallel: bool) -> String
   let mut codes = String::new();
   let mut id2nm = String::new();
   let mut id2ar = String::new();
+  let mut id2fn = String::new();
+
+  let natives = find_numeric_functions(comp);
+  let native = compile_natives(comp, &natives);
+
+  // Functions that some rule tail-calls into
+  let mut entries = HashSet::new();
+  for (name, (_arity, rules)) in &comp.rule_group {
+    for dynrule in bd::build_dynfun(comp, name, rules).rules {
+      if let Some((callee, _)) = compile_tail_call(comp, &dynrule.term) {
+        entries.insert(callee);
+      }
+    }
+  }
 
   for (id, name) in &comp.id_to_name {
     line(&mut id2nm, 1, &format!(r#"id_to_name_data[{}] = "{}";"#, id, name));
@@ -53,8 +417,14 @@ fn compile_book(comp: &rb::RuleBook, heap_size: usize, parallel: bool) -> String
     line(&mut id2ar, 1, &format!(r#"id_to_arity_data[{}] = {};"#, id, arity));
   }
 
+  for (name, is_fun) in &comp.ctr_is_cal {
+    if let (true, Some(id)) = (is_fun, comp.name_to_id.get(name)) {
+      line(&mut id2fn, 1, &format!(r#"id_to_is_fun_data[{}] = 1;"#, id));
+    }
+  }
+
   for (name, (_arity, rules)) in &comp.rule_group {
-    let (init, code) = compile_func(comp, &name, rules, 7);
+    let (init, code) = compile_func(comp, &name, rules, natives.contains(name), entries.contains(name), 7);
 
     line(
       &mut c_ids,
@@ -72,10 +442,17 @@ fn compile_book(comp: &rb::RuleBook, heap_size: usize, parallel: bool) -> String
     line(&mut codes, 6, "};");
   }
 
-  c_runtime_template(heap_size, &c_ids, &inits, &codes, &id2nm, comp.id_to_name.len() as u64, &id2ar, comp.id_to_name.len() as u64, parallel)
+  c_runtime_template(heap_size, &c_ids, &native, &inits, &codes, &id2nm, comp.id_to_name.len() as u64, &id2ar, comp.id_to_name.len() as u64, &id2fn, parallel)
 }
 
-fn compile_func(comp: &rb::RuleBook, fn_name: &str, rules: &[lang::Rule], tab: u64) -> (String, String) {
+fn compile_func(
+  comp: &rb::RuleBook,
+  fn_name: &str,
+  rules: &[lang::Rule],
+  native: bool,
+  entry: bool,
+  tab: u64,
+) -> (String, String) {
   let dynfun = bd::build_dynfun(comp, fn_name, rules);
 
   let mut init = String::new();
@@ -96,13 +473,24 @@ fn compile_func(comp: &rb::RuleBook, fn_name: &str, rules: &[lang::Rule], tab: u
   if stricts.is_empty() {
     line(&mut init, tab + 1, "init = 0;");
   } else {
-    line(&mut init, tab + 1, "stk_push(&stack, host);");
+    // With 2 or more strict arguments, tries reducing them in parallel first
+    if stricts.len() >= 2 {
+      let locs: Vec<String> = stricts.iter().map(|strict| format!("get_loc(term, {})", strict)).collect();
+      line(&mut init, tab + 1, "#ifdef PARALLEL");
+      line(&mut init, tab + 1, &format!("u64 locs[{}] = {{{}}};", stricts.len(), locs.join(", ")));
+      line(&mut init, tab + 1, &format!("if (reduce_fork(mem, locs, {})) {{", stricts.len()));
+      line(&mut init, tab + 2, "init = 0;");
+      line(&mut init, tab + 2, "continue;");
+      line(&mut init, tab + 1, "}");
+      line(&mut init, tab + 1, "#endif");
+    }
+    line(&mut init, tab + 1, "stk_push(stack, host);");
     for (i, strict) in stricts.iter().enumerate() {
       if i < stricts.len() - 1 {
         line(
           &mut init,
           tab + 1,
-          &format!("stk_push(&stack, get_loc(term, {}) | 0x80000000);", strict),
+          &format!("stk_push(stack, get_loc(term, {}) | 0x8000000000000000);", strict),
         );
       } else {
         line(&mut init, tab + 1, &format!("host = get_loc(term, {});", strict));
@@ -112,109 +500,596 @@ fn compile_func(comp: &rb::RuleBook, fn_name: &str, rules: &[lang::Rule], tab: u
   line(&mut init, tab + 1, "continue;");
   line(&mut init, tab + 0, "}");
 
+  // Entry point of tail calls from other rules, with `term` already set
+  if entry {
+    line(&mut code, tab + 0, &format!("{}CALL:;", compile_name(fn_name)));
+  }
+
+  // Loads each strict argument once; the checks below only read these
+  for strict in &stricts {
+    line(&mut code, tab + 0, &format!("u64 arg{} = ask_arg(mem, term, {});", strict, strict));
+  }
+
   // Applies the cal_par rule to superposed args
-  for (i, is_redex) in dynfun.redex.iter().enumerate() {
-    if *is_redex {
-      line(&mut code, tab + 0, &format!("if (get_tag(ask_arg(mem,term,{})) == SUP) {{", i));
+  for strict in &stricts {
+    line(&mut code, tab + 0, &format!("if (get_tag(arg{}) == SUP) {{", strict));
+    line(&mut code, tab + 1, &format!("cal_par(mem, host, term, arg{}, {});", strict, strict));
+    line(&mut code, tab + 1, "continue;");
+    line(&mut code, tab + 0, "}");
+  }
+
+  // A purely numeric function runs as plain C when all arguments are numbers.
+  // If that fails (no rule matched, or it recursed too deep), it stays on the
+  // graph path from then on.
+  if native {
+    let name = compile_name(fn_name);
+    let args: Vec<String> = (0 .. dynfun.redex.len())
+      .map(|i| if dynfun.redex[i] { format!("arg{}", i) } else { format!("ask_arg(mem, term, {})", i) })
+      .collect();
+    let mut conds = vec![format!("native_off[{}] == 0", name)];
+    conds.extend(args.iter().map(|arg| format!("get_tag({}) == NUM", arg)));
+    let nums: Vec<String> = args.iter().map(|arg| format!(", get_num({})", arg)).collect();
+    line(&mut code, tab + 0, &format!("if ({}) {{", conds.join(" && ")));
+    line(&mut code, tab + 1, "u64 ret;");
+    line(&mut code, tab + 1, &format!("PROF(mem, PROF_RULE({}, -1));", name));
+    line(&mut code, tab + 1, &format!("if ({}NATIVE(mem, 0, &ret{})) {{", name, nums.join("")));
+    line(&mut code, tab + 2, "link(mem, host, Num(ret));");
+    line(&mut code, tab + 2, &format!("clear(mem, get_loc(term, 0), {});", dynfun.redex.len()));
+    line(&mut code, tab + 2, "init = 1;");
+    line(&mut code, tab + 2, "continue;");
+    line(&mut code, tab + 1, "}");
+    line(&mut code, tab + 1, &format!("native_off[{}] = 1;", name));
+    line(&mut code, tab + 0, "}");
+  }
+
+  // Dispatches to the first matching rule through a decision tree, so that the
+  // cost of a call doesn't grow with the number of rules. A tree that would
+  // still be too big is replaced by a test per rule.
+  let label = format!("{}R", compile_name(fn_name));
+  let cands = (0 .. dynfun.rules.len()).map(|r| (r, vec![])).collect();
+  let mut used = vec![false; dynfun.rules.len()];
+  let limit = MATCH_TREE_SIZE * dynfun.rules.len();
+  let mut tree = MatchTree { code: String::new(), label: label.clone(), limit, nodes: HashMap::new(), jumps: vec![] };
+  compile_match_tree(&mut tree, tab, &dynfun, cands, &stricts, &mut used);
+  if tree.code.len() <= limit {
+    code.push_str(&tree.finish());
+  } else {
+    used = vec![true; dynfun.rules.len()];
+    compile_match_list(&mut code, tab, &dynfun, &label, &stricts);
+  }
+  line(&mut code, tab + 0, "break;");
+
+  // For each reachable rule
+  for (r, dynrule) in dynfun.rules.iter().enumerate() {
+    if !used[r] {
+      continue;
+    }
+    line(&mut code, tab + 0, &format!("{}{}: {{", label, r));
+
+    // Increments the gas count, and the rule's counters on profiling builds
+    line(&mut code, tab + 1, "inc_cost(mem);");
+    line(&mut code, tab + 1, &format!("PROF(mem, PROF_RULE({}, {}));", compile_name(fn_name), r));
+
+    // Collects unused variables (none in this example), then clears the
+    // matched ctrs (the `(Succ ...)` and the `(Add ...)` ctrs). The inner ones
+    // go first, since a freed block can't be read anymore.
+    let mut cleanup = String::new();
+    for dynvar @ bd::DynVar { param: _, field: _, erase } in dynrule.vars.iter() {
+      if *erase {
+        line(&mut cleanup, tab + 1, &format!("collect(mem, {});", get_var(dynvar)));
+      }
+    }
+    for (i, arity) in &dynrule.free {
+      let i = *i as u64;
       line(
-        &mut code,
+        &mut cleanup,
         tab + 1,
-        &format!("cal_par(mem, host, term, ask_arg(mem, term, {}), {});", i, i),
+        &format!("clear(mem, get_loc(ask_arg(mem, term, {}), 0), {});", i, arity),
       );
-      line(&mut code, tab + 1, "continue;");
-      line(&mut code, tab + 0, "}");
     }
+
+    // Builds the right-hand side term (ex: `(Succ (Add a b))`). A tail call
+    // may reuse this term's node, running the cleanup itself.
+    //let done = compile_func_rule_body(&mut code, tab + 1, &dynrule.body, &dynrule.vars);
+    let arity = dynfun.redex.len() as u64;
+    let mut reuse = if arity > 0 { Some((arity, cleanup.clone())) } else { None };
+    let done = compile_func_rule_term(&mut code, tab + 1, &dynrule.term, &dynrule.vars, &mut reuse);
+    line(&mut code, tab + 1, &format!("u64 done = {};", done));
+
+    // Links the host location to it
+    line(&mut code, tab + 1, "link(mem, host, done);");
+
+    if reuse.is_some() {
+      code.push_str(&cleanup);
+      line(&mut code, tab + 1, &format!("clear(mem, get_loc(term, 0), {});", arity));
+    }
+
+    // When the result is a call whose strict arguments are already in WHNF,
+    // jumps straight into the callee's rules, skipping its initializer
+    if let Some((callee, checks)) = compile_tail_call(comp, &dynrule.term) {
+      if checks.is_empty() {
+        line(&mut code, tab + 1, "term = done;");
+        line(&mut code, tab + 1, &format!("goto {}CALL;", compile_name(&callee)));
+      } else {
+        line(&mut code, tab + 1, &format!("if ({}) {{", checks.join(" && ")));
+        line(&mut code, tab + 2, "term = done;");
+        line(&mut code, tab + 2, &format!("goto {}CALL;", compile_name(&callee)));
+        line(&mut code, tab + 1, "}");
+      }
+    }
+
+    line(&mut code, tab + 1, "init = 1;");
+    line(&mut code, tab + 1, "continue;");
+
+    line(&mut code, tab + 0, "}");
   }
 
-  // For each rule condition vector
-  for (r, dynrule) in dynfun.rules.iter().enumerate() {
-    let mut matched: Vec<String> = Vec::new();
+  (init, code)
+}
 
-    // Tests each rule condition (ex: `get_tag(args[0]) == SUCC`)
-    for (i, cond) in dynrule.cond.iter().enumerate() {
-      let i = i as u64;
-      if rt::get_tag(*cond) == rt::NUM {
-        let same_tag = format!("get_tag(ask_arg(mem, term, {})) == NUM", i);
-        let same_val = format!("get_num(ask_arg(mem, term, {})) == {}u", i, rt::get_num(*cond));
-        matched.push(format!("({} && {})", same_tag, same_val));
+// Finds the functions that only ever take and return numbers: their rules
+// match on number literals and variables, and build their results only out of
+// numbers, numeric operations and calls to such functions. Every variable must
+// be used, since the native version evaluates arguments eagerly, which is only
+// safe when the graph would have evaluated them too.
+fn find_numeric_functions(comp: &rb::RuleBook) -> HashSet<String> {
+  fn uses(term: &bd::DynTerm, bidx: u64) -> bool {
+    match term {
+      bd::DynTerm::Var { bidx: var } => *var == bidx,
+      bd::DynTerm::Dup { expr, body, .. } => uses(expr, bidx) || uses(body, bidx),
+      bd::DynTerm::Let { expr, body } => uses(expr, bidx) || uses(body, bidx),
+      bd::DynTerm::Cal { args, .. } => args.iter().any(|arg| uses(arg, bidx)),
+      bd::DynTerm::Op2 { val0, val1, .. } => uses(val0, bidx) || uses(val1, bidx),
+      _ => false,
+    }
+  }
+  fn is_numeric(term: &bd::DynTerm, size: u64, calls: &mut Vec<(u64, usize)>) -> bool {
+    match term {
+      bd::DynTerm::Var { .. } | bd::DynTerm::Num { .. } => true,
+      bd::DynTerm::Dup { eras, expr, body } => {
+        !(eras.0 && eras.1) && is_numeric(expr, size, calls) && is_numeric(body, size + 2, calls)
+      }
+      bd::DynTerm::Let { expr, body } => {
+        uses(body, size) && is_numeric(expr, size, calls) && is_numeric(body, size + 1, calls)
       }
-      if rt::get_tag(*cond) == rt::CTR {
-        let some_tag = format!("get_tag(ask_arg(mem, term, {})) == CTR", i);
-        let some_ext = format!("get_ext(ask_arg(mem, term, {})) == {}u", i, rt::get_ext(*cond));
-        matched.push(format!("({} && {})", some_tag, some_ext));
+      bd::DynTerm::Cal { func, args } => {
+        calls.push((*func, args.len()));
+        args.iter().all(|arg| is_numeric(arg, size, calls))
       }
-        // If this is a strict argument, then we're in a default variable
-      if rt::get_tag(*cond) == rt::VAR && dynfun.redex[i as usize] {
+      bd::DynTerm::Op2 { val0, val1, .. } => is_numeric(val0, size, calls) && is_numeric(val1, size, calls),
+      _ => false,
+    }
+  }
+  let mut found: HashMap<String, Vec<(u64, usize)>> = HashMap::new();
+  for (name, (_arity, rules)) in &comp.rule_group {
+    let dynfun = bd::build_dynfun(comp, name, rules);
+    let mut calls = vec![];
+    let numeric = dynfun.rules.iter().all(|rule| {
+      rule.cond.iter().all(|cond| rt::get_tag(*cond) == rt::NUM || rt::get_tag(*cond) == rt::VAR)
+        && rule.vars.iter().all(|var| !var.erase)
+        && is_numeric(&rule.term, rule.vars.len() as u64, &mut calls)
+    });
+    if numeric {
+      found.insert(name.clone(), calls);
+    }
+  }
+  // Drops the functions that call non-numeric ones, until none is left
+  loop {
+    let drop: Vec<String> = found
+      .iter()
+      .filter(|(_, calls)| {
+        calls.iter().any(|(func, size)| {
+          let name = comp.id_to_name.get(func);
+          let arit = name.and_then(|name| comp.rule_group.get(name)).map(|(_, rules)| match &*rules[0].lhs {
+            lang::Term::Ctr { args, .. } => args.len(),
+            _ => usize::MAX,
+          });
+          !name.map_or(false, |name| found.contains_key(name)) || arit != Some(*size)
+        })
+      })
+      .map(|(name, _)| name.clone())
+      .collect();
+    if drop.is_empty() {
+      break;
+    }
+    for name in drop {
+      found.remove(&name);
+    }
+  }
+  found.into_keys().collect()
+}
 
-        // This is a Kind2-specific optimization. Check 'HOAS_OPT'.
-        if dynrule.hoas && r != dynfun.rules.len() - 1 {
+// Emits a plain C function over u64 for each numeric function. It returns 0
+// when no rule matches or the recursion gets too deep, leaving the caller to
+// reduce the graph instead. The cost counts the same rewrites as the graph.
+fn compile_natives(comp: &rb::RuleBook, natives: &HashSet<String>) -> String {
+  fn oper(oper: u64, val0: &str, val1: &str) -> String {
+    let (op, cmp) = match oper {
+      rt::ADD => ("+", false),
+      rt::SUB => ("-", false),
+      rt::MUL => ("*", false),
+      rt::DIV => ("/", false),
+      rt::MOD => ("%", false),
+      rt::AND => ("&", false),
+      rt::OR => ("|", false),
+      rt::XOR => ("^", false),
+      rt::SHL => ("<<", false),
+      rt::SHR => (">>", false),
+      rt::LTN => ("<", true),
+      rt::LTE => ("<=", true),
+      rt::EQL => ("==", true),
+      rt::GTE => (">=", true),
+      rt::GTN => (">", true),
+      _ => ("!=", true),
+    };
+    if cmp {
+      format!("(u64)({} {} {})", val0, op, val1)
+    } else {
+      format!("(({} {} {}) & NUM_MASK)", val0, op, val1)
+    }
+  }
+  // Returns the C expression of a term, emitting the calls it needs first. A
+  // call to `tail` in tail position becomes a jump back to the start, and
+  // returns no expression.
+  fn compile_expr(
+    comp: &rb::RuleBook,
+    code: &mut String,
+    tab: u64,
+    vars: &mut Vec<String>,
+    nams: &mut u64,
+    cost: &mut u64,
+    tail: Option<u64>,
+    term: &bd::DynTerm,
+  ) -> String {
+    match term {
+      bd::DynTerm::Var { bidx } => vars[*bidx as usize].clone(),
+      bd::DynTerm::Num { numb } => format!("{}ull", numb),
+      bd::DynTerm::Dup { expr, body, .. } | bd::DynTerm::Let { expr, body } => {
+        let copy = format!("v{}", *nams);
+        *nams += 1;
+        let expr = compile_expr(comp, code, tab, vars, nams, cost, None, expr);
+        line(code, tab, &format!("u64 {} = {};", copy, expr));
+        let size = if let bd::DynTerm::Dup { .. } = term { 2 } else { 1 };
+        if size == 2 {
+          *cost += 1;
+        }
+        for _ in 0 .. size {
+          vars.push(copy.clone());
+        }
+        let body = compile_expr(comp, code, tab, vars, nams, cost, tail, body);
+        for _ in 0 .. size {
+          vars.pop();
+        }
+        body
+      }
+      bd::DynTerm::Cal { func, args } => {
+        let args: Vec<String> =
+          args.iter().map(|arg| compile_expr(comp, code, tab, vars, nams, cost, None, arg)).collect();
+        if tail == Some(*func) {
+          for (i, arg) in args.iter().enumerate() {
+            line(code, tab, &format!("u64 n{} = {};", i, arg));
+          }
+          for i in 0 .. args.len() {
+            line(code, tab, &format!("a{} = n{};", i, i));
+          }
+          line(code, tab, &format!("mem->cost += {};", cost));
+          line(code, tab, "goto loop;");
+          return String::new();
+        }
+        let args: Vec<String> = args.iter().map(|arg| format!(", {}", arg)).collect();
+        let name = compile_name(&comp.id_to_name[func]);
+        let retx = format!("v{}", *nams);
+        *nams += 1;
+        line(code, tab, &format!("u64 {};", retx));
+        line(code, tab, &format!("if (!{}NATIVE(mem, depth + 1, &{}{})) {{", name, retx, args.join("")));
+        line(code, tab + 1, "return 0;");
+        line(code, tab, "}");
+        retx
+      }
+      bd::DynTerm::Op2 { oper: op, val0, val1 } => {
+        *cost += 1;
+        let val0 = compile_expr(comp, code, tab, vars, nams, cost, None, val0);
+        let val1 = compile_expr(comp, code, tab, vars, nams, cost, None, val1);
+        oper(*op, &val0, &val1)
+      }
+      _ => panic!("Not a numeric term."),
+    }
+  }
+
+  let mut protos = String::new();
+  let mut funcs = String::new();
+  let mut names: Vec<&String> = natives.iter().collect();
+  names.sort();
+  for fn_name in names {
+    let (_arity, rules) = &comp.rule_group[fn_name];
+    let dynfun = bd::build_dynfun(comp, fn_name, rules);
+    let name = compile_name(fn_name);
+    let params: Vec<String> = (0 .. dynfun.redex.len()).map(|i| format!(", u64 a{}", i)).collect();
+    let head = format!("u8 {}NATIVE(Worker* mem, u64 depth, u64* ret{})", name, params.join(""));
+    line(&mut protos, 0, &format!("{};", head));
+    line(&mut funcs, 0, "");
+    line(&mut funcs, 0, &format!("{} {{", head));
+    line(&mut funcs, 1, "if (depth >= NATIVE_DEPTH) {");
+    line(&mut funcs, 2, "return 0;");
+    line(&mut funcs, 1, "}");
+    let fid = comp.name_to_id[fn_name];
+    let mut total = false;
+    let mut code = String::new();
+    for dynrule in &dynfun.rules {
+      let mut conds = vec![];
+      for (i, cond) in dynrule.cond.iter().enumerate() {
+        if rt::get_tag(*cond) == rt::NUM {
+          conds.push(format!("a{} == {}ull", i, rt::get_num(*cond)));
+        }
+      }
+      let tab = if conds.is_empty() { 1 } else { 2 };
+      if !conds.is_empty() {
+        line(&mut code, 1, &format!("if ({}) {{", conds.join(" && ")));
+      }
+      let mut vars: Vec<String> = dynrule.vars.iter().map(|var| format!("a{}", var.param)).collect();
+      let mut nams = 0;
+      let mut cost = 1;
+      let done = compile_expr(comp, &mut code, tab, &mut vars, &mut nams, &mut cost, Some(fid), &dynrule.term);
+      if !done.is_empty() {
+        line(&mut code, tab, &format!("mem->cost += {};", cost));
+        line(&mut code, tab, &format!("*ret = {};", done));
+        line(&mut code, tab, "return 1;");
+      }
+      if conds.is_empty() {
+        total = true;
+        break;
+      }
+      line(&mut code, 1, "}");
+    }
+    if !total {
+      line(&mut code, 1, "return 0;");
+    }
+    if code.contains("goto loop;") {
+      line(&mut funcs, 1, "loop:;");
+    }
+    funcs.push_str(&code);
+    line(&mut funcs, 0, "}");
+  }
+  format!("{}{}", protos, funcs)
+}
 
-          // Matches number literals
-          let is_num
-            = format!("get_tag(ask_arg(mem, term, {})) == NUM", i);
+// If a rule's result is a call to a function with rules, returns that function
+// and the checks under which its strict arguments, read from `done`, are WHNF.
+// Literal numbers and constructors need none.
+fn compile_tail_call(comp: &rb::RuleBook, term: &bd::DynTerm) -> Option<(String, Vec<String>)> {
+  match term {
+    bd::DynTerm::Dup { body, .. } | bd::DynTerm::Let { body, .. } => compile_tail_call(comp, body),
+    bd::DynTerm::Cal { func, args } => {
+      let name = comp.id_to_name.get(func)?;
+      let (_, rules) = comp.rule_group.get(name)?;
+      let redex = bd::build_dynfun(comp, name, rules).redex;
+      if redex.len() != args.len() {
+        return None;
+      }
+      let mut checks = vec![];
+      for (i, arg) in args.iter().enumerate() {
+        match arg {
+          bd::DynTerm::Num { .. } | bd::DynTerm::Flo { .. } | bd::DynTerm::Ctr { .. } => {}
+          _ if redex[i] => {
+            checks.push(format!("(get_tag(ask_arg(mem, done, {})) == NUM || get_tag(ask_arg(mem, done, {})) == CTR)", i, i));
+          }
+          _ => {}
+        }
+      }
+      Some((name.clone(), checks))
+    }
+    _ => None,
+  }
+}
 
-          // Matches constructor labels
-          let is_ctr = format!("({} && {})",
-            format!("get_tag(ask_arg(mem, term, {})) == CTR", i),
-            format!("ask_ari(mem, ask_arg(mem, term, {})) == 0u", i));
+// Average bytes of C per rule past which a match tree is replaced by a test per rule
+const MATCH_TREE_SIZE: usize = 8192;
 
-          // Matches HOAS numbers and constructors
-          let is_hoas_ctr_num = format!("({} && {} && {})",
-            format!("get_tag(ask_arg(mem, term, {})) == CTR", i),
-            format!("get_ext(ask_arg(mem, term, {})) >= HOAS_CT0", i),
-            format!("get_ext(ask_arg(mem, term, {})) <= HOAS_NUM", i));
+// A match tree being built. Since candidates with a variable on a switched
+// argument go to every branch, the same set of candidates is often reached
+// from several places; its subtree is then emitted once, under a label, and
+// jumped to from the others.
+struct MatchTree {
+  code: String,
+  label: String,
+  limit: usize,
+  nodes: HashMap<(Vec<(usize, Vec<String>)>, Vec<u64>), usize>,
+  jumps: Vec<bool>,
+}
 
-          matched.push(format!("({} || {} || {})", is_num, is_ctr, is_hoas_ctr_num));
+impl MatchTree {
+  fn node_label(&self, node: usize) -> String {
+    format!("{}T{}", self.label, node)
+  }
 
-        // Only match default variables on CTRs and NUMs
-        } else {
-          let is_ctr = format!("get_tag(ask_arg(mem, term, {})) == CTR", i);
-          let is_num = format!("get_tag(ask_arg(mem, term, {})) == NUM", i);
-          matched.push(format!("({} || {})", is_ctr, is_num));
+  // The code of the tree, without the labels of subtrees that weren't shared
+  fn finish(self) -> String {
+    let mut code = String::new();
+    for text in self.code.lines() {
+      let unused = text.trim().strip_suffix(":;").and_then(|name| name.strip_prefix(&format!("{}T", self.label)));
+      if let Some(node) = unused.and_then(|node| node.parse::<usize>().ok()) {
+        if !self.jumps[node] {
+          continue;
         }
-
       }
+      code.push_str(text);
+      code.push('\n');
     }
+    code
+  }
+}
 
-    let conds = if matched.is_empty() { String::from("1") } else { matched.join(" && ") };
-    line(&mut code, tab + 0, &format!("if ({}) {{", conds));
+// Builds the match decision tree of a function. Each candidate is a rule that
+// may still match, together with the runtime checks it still needs. A node
+// switches on the tag and then on the constructor id or number of the first
+// argument the leading candidate tests; candidates with a variable there go to
+// every branch. When the leading candidate tests nothing else, it is tried
+// directly, and the others are only considered if it fails. Falling out of a
+// node means no rule matched, so a shared node can be jumped to from anywhere.
+fn compile_match_tree(
+  tree: &mut MatchTree,
+  tab: u64,
+  dynfun: &bd::DynFun,
+  mut cands: Vec<(usize, Vec<String>)>,
+  cols: &[u64],
+  used: &mut [bool],
+) {
+  // Past the limit the tree is dropped, so the rest isn't built
+  if tree.code.len() > tree.limit {
+    return;
+  }
+  let key = (cands.clone(), cols.to_vec());
+  if let Some(node) = tree.nodes.get(&key) {
+    tree.jumps[*node] = true;
+    let text = format!("goto {};", tree.node_label(*node));
+    line(&mut tree.code, tab, &text);
+    return;
+  }
+  let node = tree.jumps.len();
+  tree.nodes.insert(key, node);
+  tree.jumps.push(false);
+  let text = format!("{}:;", tree.node_label(node));
+  line(&mut tree.code, tab, &text);
+  let label = tree.label.clone();
 
-    // Increments the gas count
-    line(&mut code, tab + 1, "inc_cost(mem);");
+  let last = dynfun.rules.len() - 1;
+  let is_key = |r: usize, i: u64| {
+    let cond = dynfun.rules[r].cond[i as usize];
+    rt::get_tag(cond) == rt::CTR || rt::get_tag(cond) == rt::NUM
+  };
+  // This is a Kind2-specific optimization. Check 'HOAS_OPT'.
+  let is_hoas = |r: usize| dynfun.rules[r].hoas && r != last;
+  let hoas_ctr = |i: u64| {
+    format!("(get_ari(arg{}) == 0u || (get_fun(arg{}) >= {}u && get_fun(arg{}) <= {}u))", i, i, rt::HOAS_CT0, i, rt::HOAS_NUM)
+  };
 
-    // Builds the right-hand side term (ex: `(Succ (Add a b))`)
-    //let done = compile_func_rule_body(&mut code, tab + 1, &dynrule.body, &dynrule.vars);
-    let done = compile_func_rule_term(&mut code, tab + 1, &dynrule.term, &dynrule.vars);
-    line(&mut code, tab + 1, &format!("u64 done = {};", done));
+  while !cands.is_empty() {
+    let (r, left) = &cands[0];
+    let col = cols.iter().find(|i| is_key(*r, **i));
 
-    // Links the host location to it
-    line(&mut code, tab + 1, "link(mem, host, done);");
+    // The leading candidate only needs its default variables to be CTRs or numbers
+    let col = match col {
+      Some(col) => *col,
+      None => {
+        let mut checks = left.clone();
+        for i in cols {
+          if is_hoas(*r) {
+            checks.push(format!("(get_tag(arg{}) == NUM || get_tag(arg{}) == FLO || (get_tag(arg{}) == CTR && {}))", i, i, i, hoas_ctr(*i)));
+          } else {
+            checks.push(format!("(get_tag(arg{}) == CTR || get_tag(arg{}) == NUM || get_tag(arg{}) == FLO)", i, i, i));
+          }
+        }
+        used[*r] = true;
+        if checks.is_empty() {
+          line(&mut tree.code, tab + 0, &format!("goto {}{};", label, r));
+          return;
+        }
+        line(&mut tree.code, tab + 0, &format!("if ({}) {{", checks.join(" && ")));
+        line(&mut tree.code, tab + 1, &format!("goto {}{};", label, r));
+        line(&mut tree.code, tab + 0, "}");
+        cands.remove(0);
+        continue;
+      }
+    };
 
-    // Clears the matched ctrs (the `(Succ ...)` and the `(Add ...)` ctrs)
-    line(&mut code, tab + 1, &format!("clear(mem, get_loc(term, 0), {});", dynfun.redex.len()));
-    for (i, arity) in &dynrule.free {
-      let i = *i as u64;
-      line(
-        &mut code,
-        tab + 1,
-        &format!("clear(mem, get_loc(ask_arg(mem, term, {}), 0), {});", i, arity),
-      );
-    }
+    let rest: Vec<u64> = cols.iter().filter(|i| **i != col).copied().collect();
 
-    // Collects unused variables (none in this example)
-    for dynvar @ bd::DynVar { param: _, field: _, erase } in dynrule.vars.iter() {
-      if *erase {
-        line(&mut code, tab + 1, &format!("collect(mem, {});", get_var(dynvar)));
+    // Collects the constructors and numbers tested on this argument, in order
+    let mut ctrs: Vec<u64> = vec![];
+    let mut nums: Vec<u64> = vec![];
+    for (r, _) in &cands {
+      let cond = dynfun.rules[*r].cond[col as usize];
+      if rt::get_tag(cond) == rt::CTR && !ctrs.contains(&rt::get_fun(cond)) {
+        ctrs.push(rt::get_fun(cond));
+      }
+      if rt::get_tag(cond) == rt::NUM && !nums.contains(&rt::get_num(cond)) {
+        nums.push(rt::get_num(cond));
       }
     }
 
-    line(&mut code, tab + 1, "init = 1;");
-    line(&mut code, tab + 1, "continue;");
+    // The candidates of a branch: the ones that test `key` plus, when `tag`
+    // is given, the ones with a variable on this argument
+    let branch = |tag: u64, key: Option<u64>| -> Vec<(usize, Vec<String>)> {
+      let mut sub = vec![];
+      for (r, left) in &cands {
+        let cond = dynfun.rules[*r].cond[col as usize];
+        if is_key(*r, col) {
+          let same = match key {
+            Some(key) if rt::get_tag(cond) == tag => {
+              if tag == rt::CTR { rt::get_fun(cond) == key } else { rt::get_num(cond) == key }
+            }
+            _ => false,
+          };
+          if same {
+            sub.push((*r, left.clone()));
+          }
+        } else {
+          let mut left = left.clone();
+          if tag == rt::CTR && is_hoas(*r) {
+            left.push(hoas_ctr(col));
+          }
+          sub.push((*r, left));
+        }
+      }
+      sub
+    };
 
-    line(&mut code, tab + 0, "}");
+    line(&mut tree.code, tab + 0, &format!("switch (get_tag(arg{})) {{", col));
+    for (tag, tag_name, keys) in [(rt::CTR, "CTR", &ctrs), (rt::NUM, "NUM", &nums), (rt::FLO, "FLO", &vec![])] {
+      line(&mut tree.code, tab + 1, &format!("case {}: {{", tag_name));
+      if keys.is_empty() {
+        compile_match_tree(tree, tab + 2, dynfun, branch(tag, None), &rest, used);
+      } else {
+        let getter = if tag == rt::CTR { "get_fun" } else { "get_num" };
+        line(&mut tree.code, tab + 2, &format!("switch ({}(arg{})) {{", getter, col));
+        for key in keys {
+          line(&mut tree.code, tab + 3, &format!("case {}u: {{", key));
+          compile_match_tree(tree, tab + 4, dynfun, branch(tag, Some(*key)), &rest, used);
+          line(&mut tree.code, tab + 4, "break;");
+          line(&mut tree.code, tab + 3, "}");
+        }
+        line(&mut tree.code, tab + 3, "default: {");
+        compile_match_tree(tree, tab + 4, dynfun, branch(tag, None), &rest, used);
+        line(&mut tree.code, tab + 4, "break;");
+        line(&mut tree.code, tab + 3, "}");
+        line(&mut tree.code, tab + 2, "}");
+      }
+      line(&mut tree.code, tab + 2, "break;");
+      line(&mut tree.code, tab + 1, "}");
+    }
+    line(&mut tree.code, tab + 0, "}");
+    return;
   }
+}
 
-  (init, code)
+// Tests the rules one by one, in order, as the fallback for a function whose
+// match tree is too big
+fn compile_match_list(code: &mut String, tab: u64, dynfun: &bd::DynFun, label: &str, cols: &[u64]) {
+  let last = dynfun.rules.len() - 1;
+  for (r, dynrule) in dynfun.rules.iter().enumerate() {
+    let mut checks = vec![];
+    for i in cols {
+      let cond = dynrule.cond[*i as usize];
+      if rt::get_tag(cond) == rt::CTR {
+        checks.push(format!("(get_tag(arg{}) == CTR && get_fun(arg{}) == {}u)", i, i, rt::get_fun(cond)));
+      } else if rt::get_tag(cond) == rt::NUM {
+        checks.push(format!("(get_tag(arg{}) == NUM && get_num(arg{}) == {}u)", i, i, rt::get_num(cond)));
+      // This is a Kind2-specific optimization. Check 'HOAS_OPT'.
+      } else if dynrule.hoas && r != last {
+        let hoas_ctr = format!(
+          "(get_ari(arg{}) == 0u || (get_fun(arg{}) >= {}u && get_fun(arg{}) <= {}u))",
+          i, i, rt::HOAS_CT0, i, rt::HOAS_NUM
+        );
+        checks.push(format!("(get_tag(arg{}) == NUM || get_tag(arg{}) == FLO || (get_tag(arg{}) == CTR && {}))", i, i, i, hoas_ctr));
+      } else {
+        checks.push(format!("(get_tag(arg{}) == CTR || get_tag(arg{}) == NUM || get_tag(arg{}) == FLO)", i, i, i));
+      }
+    }
+    let conds = if checks.is_empty() { String::from("1") } else { checks.join(" && ") };
+    line(code, tab + 0, &format!("if ({}) {{", conds));
+    line(code, tab + 1, &format!("goto {}{};", label, r));
+    line(code, tab + 0, "}");
+  }
 }
 
 fn compile_func_rule_term(
@@ -222,6 +1097,7 @@ fn compile_func_rule_term(
   tab: u64,
   term: &bd::DynTerm,
   vars: &[bd::DynVar],
+  reuse: &mut Option<(u64, String)>,
 ) -> String {
   fn alloc_lam(
     code: &mut String,
@@ -251,6 +1127,7 @@ fn compile_func_rule_term(
     nams: &mut u64,
     globs: &mut HashMap<u64, String>,
     term: &bd::DynTerm,
+    reuse: &mut Option<(u64, String)>,
   ) -> String {
     const INLINE_NUMBERS: bool = true;
     //println!("compile {:?}", term);
@@ -274,12 +1151,12 @@ fn compile_func_rule_term(
         let copy = fresh(nams, "cpy");
         let dup0 = fresh(nams, "dp0");
         let dup1 = fresh(nams, "dp1");
-        let expr = compile_term(code, tab, vars, nams, globs, expr);
+        let expr = compile_term(code, tab, vars, nams, globs, expr, &mut None);
         line(code, tab, &format!("u64 {} = {};", copy, expr));
         line(code, tab, &format!("u64 {};", dup0));
         line(code, tab, &format!("u64 {};", dup1));
         if INLINE_NUMBERS {
-          line(code, tab + 0, &format!("if (get_tag({}) == NUM) {{", copy));
+          line(code, tab + 0, &format!("if (get_tag({}) == NUM || get_tag({}) == FLO) {{", copy, copy));
           line(code, tab + 1, "inc_cost(mem);");
           line(code, tab + 1, &format!("{} = {};", dup0, copy));
           line(code, tab + 1, &format!("{} = {};", dup1, copy));
@@ -305,22 +1182,22 @@ fn compile_func_rule_term(
         }
         vars.push(dup0);
         vars.push(dup1);
-        let body = compile_term(code, tab + 0, vars, nams, globs, body);
+        let body = compile_term(code, tab + 0, vars, nams, globs, body, reuse);
         vars.pop();
         vars.pop();
         body
       }
       bd::DynTerm::Let { expr, body } => {
-        let expr = compile_term(code, tab, vars, nams, globs, expr);
+        let expr = compile_term(code, tab, vars, nams, globs, expr, &mut None);
         vars.push(expr);
-        let body = compile_term(code, tab, vars, nams, globs, body);
+        let body = compile_term(code, tab, vars, nams, globs, body, reuse);
         vars.pop();
         body
       }
       bd::DynTerm::Lam { eras, glob, body } => {
         let name = alloc_lam(code, tab, nams, globs, *glob);
         vars.push(format!("Var({})", name));
-        let body = compile_term(code, tab, vars, nams, globs, body);
+        let body = compile_term(code, tab, vars, nams, globs, body, &mut None);
         vars.pop();
         if *eras {
           line(code, tab, &format!("link(mem, {} + 0, Era());", name));
@@ -330,8 +1207,8 @@ fn compile_func_rule_term(
       }
       bd::DynTerm::App { func, argm } => {
         let name = fresh(nams, "app");
-        let func = compile_term(code, tab, vars, nams, globs, func);
-        let argm = compile_term(code, tab, vars, nams, globs, argm);
+        let func = compile_term(code, tab, vars, nams, globs, func, &mut None);
+        let argm = compile_term(code, tab, vars, nams, globs, argm, &mut None);
         line(code, tab, &format!("u64 {} = alloc(mem, 2);", name));
         line(code, tab, &format!("link(mem, {} + 0, {});", name, func));
         line(code, tab, &format!("link(mem, {} + 1, {});", name, argm));
@@ -339,7 +1216,7 @@ fn compile_func_rule_term(
       }
       bd::DynTerm::Ctr { func, args } => {
         let ctr_args: Vec<String> =
-          args.iter().map(|arg| compile_term(code, tab, vars, nams, globs, arg)).collect();
+          args.iter().map(|arg| compile_term(code, tab, vars, nams, globs, arg, &mut None)).collect();
         let name = fresh(nams, "ctr");
         line(code, tab, &format!("u64 {} = alloc(mem, {});", name, ctr_args.len()));
         for (i, arg) in ctr_args.iter().enumerate() {
@@ -349,8 +1226,22 @@ fn compile_func_rule_term(
       }
       bd::DynTerm::Cal { func, args } => {
         let cal_args: Vec<String> =
-          args.iter().map(|arg| compile_term(code, tab, vars, nams, globs, arg)).collect();
+          args.iter().map(|arg| compile_term(code, tab, vars, nams, globs, arg, &mut None)).collect();
         let name = fresh(nams, "cal");
+        // A tail call with the arity of the caller takes over its node. Every
+        // argument is read before the cleanup, which may free matched fields.
+        if matches!(reuse, Some((arity, _)) if *arity == cal_args.len() as u64) {
+          let (_, cleanup) = reuse.take().unwrap();
+          for (i, arg) in cal_args.iter().enumerate() {
+            line(code, tab, &format!("u64 {}_{} = {};", name, i, arg));
+          }
+          code.push_str(&cleanup);
+          line(code, tab, &format!("u64 {} = get_loc(term, 0);", name));
+          for i in 0 .. cal_args.len() {
+            line(code, tab, &format!("link(mem, {} + {}, {}_{});", name, i, name, i));
+          }
+          return format!("Cal({}, {}, {})", cal_args.len(), func, name);
+        }
         line(code, tab, &format!("u64 {} = alloc(mem, {});", name, cal_args.len()));
         for (i, arg) in cal_args.iter().enumerate() {
           line(code, tab, &format!("link(mem, {} + {}, {});", name, i, arg));
@@ -360,11 +1251,14 @@ fn compile_func_rule_term(
       bd::DynTerm::Num { numb } => {
         format!("Num({}ull)", numb)
       }
+      bd::DynTerm::Flo { numb } => {
+        format!("Flo({}ull)", numb)
+      }
       bd::DynTerm::Op2 { oper, val0, val1 } => {
         let retx = fresh(nams, "ret");
         let name = fresh(nams, "op2");
-        let val0 = compile_term(code, tab, vars, nams, globs, val0);
-        let val1 = compile_term(code, tab, vars, nams, globs, val1);
+        let val0 = compile_term(code, tab, vars, nams, globs, val0, &mut None);
+        let val1 = compile_term(code, tab, vars, nams, globs, val1, &mut None);
         line(code, tab + 0, &format!("u64 {};", retx));
         // Optimization: do inline operation, avoiding Op2 allocation, when operands are already number
         if INLINE_NUMBERS {
@@ -445,7 +1339,7 @@ fn compile_func_rule_term(
     })
     .collect();
   let mut globs: HashMap<u64, String> = HashMap::new();
-  compile_term(code, tab, &mut vars, &mut nams, &mut globs, term)
+  compile_term(code, tab, &mut vars, &mut nams, &mut globs, term, reuse)
 }
 
 fn get_var(var: &bd::DynVar) -> String {
@@ -481,30 +1375,37 @@ fn line(code: &mut String, tab: u64, line: &str) {
 const REPLACEMENT_TOKEN_PATTERN: &str =
   r"(?s)(?:/\*! *(\w+?) *!\*/)|(?:/\*! *(\w+?) *\*/.+?/\* *(\w+?) *!\*/)";
 
+const C_RUNTIME_TEMPLATE: &str = include_str!("runtime.c");
+const C_RULES_TEMPLATE: &str = include_str!("rules.c");
+const C_COMPILER_SOURCE: &str = include_str!("compiler.rs"); // part of the cache key of builds
+
 fn c_runtime_template(
   heap_size: usize,
   c_ids: &str,
+  native: &str,
   inits: &str,
   codes: &str,
   id2nm: &str,
   nmlen: u64,
   id2ar: &str,
   arlen: u64,
+  id2fn: &str,
   parallel: bool,
 ) -> String {
-  const C_RUNTIME_TEMPLATE: &str = include_str!("runtime.c");
   // Instantiate the template with the given sections' content
 
   const C_HEAP_SIZE_TAG: &str = "GENERATED_HEAP_SIZE";
   const C_PARALLEL_FLAG_TAG: &str = "GENERATED_PARALLEL_FLAG";
   const C_NUM_THREADS_TAG: &str = "GENERATED_NUM_THREADS";
   const C_CONSTRUCTOR_IDS_TAG: &str = "GENERATED_CONSTRUCTOR_IDS";
+  const C_NATIVE_FUNCTIONS_TAG: &str = "GENERATED_NATIVE_FUNCTIONS";
   const C_REWRITE_RULES_STEP_0_TAG: &str = "GENERATED_REWRITE_RULES_STEP_0";
   const C_REWRITE_RULES_STEP_1_TAG: &str = "GENERATED_REWRITE_RULES_STEP_1";
   const C_NAME_COUNT_TAG: &str = "GENERATED_NAME_COUNT";
   const C_ID_TO_NAME_DATA_TAG: &str = "GENERATED_ID_TO_NAME_DATA";
   const C_ARITY_COUNT_TAG: &str = "GENERATED_ARITY_COUNT";
   const C_ID_TO_ARITY_DATA_TAG: &str = "GENERATED_ID_TO_ARITY_DATA";
+  const C_ID_TO_IS_FUN_DATA_TAG: &str = "GENERATED_ID_TO_IS_FUN_DATA";
 
   // TODO: Sanity checks: all tokens we're looking for must be present in the
   // `runtime.c` file.
@@ -537,12 +1438,14 @@ fn c_runtime_template(
       C_PARALLEL_FLAG_TAG => parallel_flag,
       C_NUM_THREADS_TAG => num_threads,
       C_CONSTRUCTOR_IDS_TAG => c_ids,
+      C_NATIVE_FUNCTIONS_TAG => native,
       C_REWRITE_RULES_STEP_0_TAG => inits,
       C_REWRITE_RULES_STEP_1_TAG => codes,
       C_NAME_COUNT_TAG => nmlen,
       C_ID_TO_NAME_DATA_TAG => id2nm,
       C_ARITY_COUNT_TAG => arlen,
       C_ID_TO_ARITY_DATA_TAG => id2ar,
+      C_ID_TO_IS_FUN_DATA_TAG => id2fn,
       _ => panic!("Unknown replacement tag."),
     }
     .to_string()
@@ -550,3 +1453,20 @@ fn c_runtime_template(
 
   (*result).to_string()
 }
+
+#[cfg(test)]
+mod tests {
+  use super::hash_book;
+  use crate::language as lang;
+  use crate::rulebook as rb;
+
+  #[test]
+  fn test_hash_book_rule_order() {
+    // the first rule that matches wins, so these must not share a cached build
+    let book_a = rb::gen_rulebook(&lang::read_file("(F 0) = 1 (F x) = 2").unwrap());
+    let book_b = rb::gen_rulebook(&lang::read_file("(F x) = 2 (F 0) = 1").unwrap());
+    assert_ne!(hash_book(&book_a, true), hash_book(&book_b, true));
+    let book_c = rb::gen_rulebook(&lang::read_file("(F 0) = 1 (F x) = 2").unwrap());
+    assert_eq!(hash_book(&book_a, true), hash_book(&book_c, true));
+  }
+}
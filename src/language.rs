@@ -18,6 +18,7 @@ pub enum Term {
   App { func: BTerm, argm: BTerm },
   Ctr { name: String, args: Vec<BTerm> },
   Num { numb: u64 },
+  Flo { numb: u64 }, // a double, without the 4 least significant bits of its mantissa
   Op2 { oper: Oper, val0: BTerm, val1: BTerm },
 }
 
@@ -171,11 +172,59 @@ impl fmt::Display for Term {
         write!(f, "({}{})", name, args.iter().map(|x| format!(" {}", x)).collect::<String>())
       }
       Self::Num { numb } => write!(f, "{}", numb),
+      Self::Flo { numb } => write!(f, "{}", show_flo(*numb)),
       Self::Op2 { oper, val0, val1 } => write!(f, "({} {} {})", oper, val0, val1),
     }
   }
 }
 
+// Shows a float as the shortest decimal that reads back as it. It never uses an
+// exponent, and always has a dot, so that it doesn't read back as a Num.
+pub fn show_flo(numb: u64) -> String {
+  let x = f64::from_bits(numb << 4);
+  if x.is_nan() {
+    return "NaN".to_string();
+  }
+  let sign = if x.is_sign_negative() { "-" } else { "" };
+  let x = x.abs();
+  if x.is_infinite() {
+    return format!("{}inf", sign);
+  }
+  let mut sci = String::new();
+  for prec in 0 .. 17 {
+    sci = format!("{:.*e}", prec, x);
+    if sci.parse::<f64>().map_or(false, |y| y.to_bits() >> 4 == x.to_bits() >> 4) {
+      break;
+    }
+  }
+  // Splits "d.ddde-X" into its digits and exponent
+  let (mant, expo) = sci.split_once('e').unwrap();
+  let mut digs: Vec<char> = mant.chars().filter(|c| *c != '.').collect();
+  while digs.len() > 1 && digs[digs.len() - 1] == '0' {
+    digs.pop();
+  }
+  let expo = expo.parse::<i64>().unwrap();
+  let mut text = String::from(sign);
+  if expo < 0 {
+    text.push_str("0.");
+    for _ in 0 .. -expo - 1 {
+      text.push('0');
+    }
+    text.extend(digs.iter());
+  } else {
+    let expo = expo as usize;
+    for i in 0 ..= expo {
+      text.push(*digs.get(i).unwrap_or(&'0'));
+    }
+    text.push('.');
+    if digs.len() <= expo + 1 {
+      text.push('0');
+    }
+    text.extend(digs.iter().skip(expo + 1));
+  }
+  text
+}
+
 // Rule
 // ----
 
@@ -301,7 +350,13 @@ pub fn parse_u60(state: parser::State) -> parser::Answer<Option<BTerm>> {
     }),
     Box::new(|state| {
       let (state, numb) = parser::name1(state)?;
-      if !numb.is_empty() {
+      // Numbers with a dot are floats
+      if numb.contains('.') {
+        match numb.parse::<f64>() {
+          Ok(flo) => Ok((state, Box::new(Term::Flo { numb: flo.to_bits() >> 4 }))),
+          Err(_) => parser::expected("float", numb.len(), state),
+        }
+      } else if !numb.is_empty() {
         Ok((state, Box::new(Term::Num { numb: numb.parse::<u64>().unwrap() })))
       } else {
         Ok((state, Box::new(Term::Num { numb: 0 })))
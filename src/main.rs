@@ -1,3 +1,4 @@
+mod bench;
 mod builder;
 mod cli;
 mod compiler;
@@ -37,19 +38,28 @@ fn run_cli() -> Result<(), String> {
       compile_code(&code, file, cli_matches.memory_size, !single_thread)?;
       Ok(())
     }
-    Command::Run { file, params } => {
+    Command::Run { file, params, native, tiered } => {
       let code = load_file_code(&hvm(&file))?;
 
-      run_code(&code, false, params, cli_matches.memory_size / std::mem::size_of::<u64>())?;
+      if native {
+        run_native_code(&code, params, cli_matches.memory_size)?;
+      } else {
+        run_code(&code, false, tiered, params, cli_matches.memory_size / std::mem::size_of::<u64>())?;
+      }
       Ok(())
     }
 
     Command::Debug { file, params } => {
       let code = load_file_code(&hvm(&file))?;
 
-      run_code(&code, true, params, cli_matches.memory_size / std::mem::size_of::<u64>())?;
+      run_code(&code, true, false, params, cli_matches.memory_size / std::mem::size_of::<u64>())?;
       Ok(())
     }
+
+    Command::Bench { names, dir, sizes, threads, runs, baseline, save, threshold, rules } => {
+      let heap_size = cli_matches.memory_size;
+      bench::run_bench(&bench::Options { names, dir, sizes, threads, runs, baseline, save, threshold, heap_size, rules })
+    }
   }
 }
 
@@ -63,9 +73,9 @@ fn make_main_call(params: &Vec<String>) -> Result<language::Term, String> {
   Ok(language::Term::Ctr { name, args })
 }
 
-fn run_code(code: &str, debug: bool, params: Vec<String>, memory: usize) -> Result<(), String> {
+fn run_code(code: &str, debug: bool, tiered: bool, params: Vec<String>, memory: usize) -> Result<(), String> {
   let call = make_main_call(&params)?;
-  let (norm, cost, size, time) = builder::eval_code(&call, code, debug, memory)?;
+  let (norm, cost, size, time) = builder::eval_code_with_tiers(&call, code, debug, tiered, memory)?;
   println!("{}", norm);
   eprintln!();
   eprintln!("Rewrites: {} ({:.2} MR/s)", cost, (cost as f64) / (time as f64) / 1000.0);
@@ -73,6 +83,11 @@ fn run_code(code: &str, debug: bool, params: Vec<String>, memory: usize) -> Resu
   Ok(())
 }
 
+fn run_native_code(code: &str, params: Vec<String>, heap_size: usize) -> Result<(), String> {
+  let path = compiler::compile_native(code, true)?;
+  compiler::run_native(&path, heap_size, &params)
+}
+
 fn compile_code(code: &str, name: &str, heap_size: usize, parallel: bool) -> Result<(), String> {
   if !name.ends_with(".hvm") {
     return Err("Input file must end with .hvm.".to_string());
@@ -66,7 +66,7 @@ pub fn as_term(mem: &Worker, i2n: Option<&HashMap<u64, String>>, host: u64) -> B
         gen_var_names(mem, ctx, arg0, depth + 1);
         gen_var_names(mem, ctx, arg1, depth + 1);
       }
-      rt::NUM => {}
+      rt::NUM | rt::FLO => {}
       rt::CTR | rt::FUN => {
         let arity = rt::ask_ari(mem, term);
         for i in 0..arity {
@@ -195,8 +195,12 @@ pub fn as_term(mem: &Worker, i2n: Option<&HashMap<u64, String>>, host: u64) -> B
         let numb = rt::get_num(term);
         return Box::new(lang::Term::Num { numb });
       }
+      rt::FLO => {
+        let numb = rt::get_num(term);
+        return Box::new(lang::Term::Flo { numb });
+      }
       rt::CTR | rt::FUN => {
-        let func = rt::get_ext(term);
+        let func = rt::get_fun(term);
         let arit = rt::ask_ari(mem, term);
         let mut args = Vec::new();
         for i in 0 .. arit {
@@ -334,7 +338,7 @@ pub fn as_linear_term(rt: &Worker, i2n: Option<&HashMap<u64, String>>, host: u64
         StackItem::Resolver(term) => {
           match rt::get_tag(term) {
             rt::CTR => {
-              let func = rt::get_ext(term);
+              let func = rt::get_fun(term);
               let arit = rt::ask_ari(rt, term);
               let mut args = Vec::new();
               for _ in 0..arit {
@@ -344,7 +348,7 @@ pub fn as_linear_term(rt: &Worker, i2n: Option<&HashMap<u64, String>>, host: u64
               output.push(lang::Term::Ctr { name, args });
             },
             rt::FUN => {
-              let func = rt::get_ext(term);
+              let func = rt::get_fun(term);
               let arit = rt::ask_ari(rt, term);
               let mut args = Vec::new();
               for _ in 0..arit {
@@ -424,6 +428,10 @@ pub fn as_linear_term(rt: &Worker, i2n: Option<&HashMap<u64, String>>, host: u64
               let numb = rt::get_num(term);
               output.push(lang::Term::Num { numb });
             }
+            rt::FLO => {
+              let numb = rt::get_num(term);
+              output.push(lang::Term::Flo { numb });
+            }
             rt::CTR => {
               let arit = rt::ask_ari(rt, term);
               stack.push(StackItem::Resolver(term));
@@ -161,6 +161,25 @@ pub fn gen_rulebook(file: &lang::File) -> RuleBook {
   book
 }
 
+// Fails if the book has more names, or bigger arities, than links can hold
+pub fn check_rulebook(book: &RuleBook) -> Result<(), String> {
+  if book.name_count > rt::MAX_FUN_ID + 1 {
+    return Err(format!(
+      "Too many constructor and function names: {} (the limit is {}).",
+      book.name_count,
+      rt::MAX_FUN_ID + 1
+    ));
+  }
+  let mut arits: Vec<(&u64, &u64)> = book.id_to_arit.iter().collect();
+  arits.sort();
+  for (id, arit) in arits {
+    if *arit > rt::MAX_FUN_ARI {
+      return Err(format!("Too many fields on '{}': {} (the limit is {}).", book.id_to_name[id], arit, rt::MAX_FUN_ARI));
+    }
+  }
+  Ok(())
+}
+
 // Groups rules by name. For example:
 //   (add (succ a) (succ b)) = (succ (succ (add a b)))
 //   (add (succ a) (zero)  ) = (succ a)
@@ -369,6 +388,10 @@ pub fn sanitize_rule(rule: &lang::Rule) -> Result<lang::Rule, String> {
         let term = lang::Term::Num { numb: *numb };
         Box::new(term)
       }
+      lang::Term::Flo { numb } => {
+        let term = lang::Term::Flo { numb: *numb };
+        Box::new(term)
+      }
     };
 
     Ok(term)
@@ -508,7 +531,7 @@ pub fn sanitize_rules(rules: &[lang::Rule]) -> Vec<lang::Rule> {
 mod tests {
   use core::panic;
 
-  use super::{gen_rulebook, sanitize_rule};
+  use super::{check_rulebook, gen_rulebook, sanitize_rule};
   use crate::language::{read_file, read_rule};
 
   #[test]
@@ -573,6 +596,19 @@ mod tests {
     }
   }
 
+  #[test]
+  fn test_check_rulebook() {
+    // ids and arities must fit on a link
+    let fields = |n: usize| vec!["0"; n].join(" ");
+    let file = read_file(&format!("(Main) = (Big {})", fields(256))).unwrap();
+    assert!(check_rulebook(&gen_rulebook(&file)).is_err());
+    let file = read_file(&format!("(Main) = (Big {})", fields(255))).unwrap();
+    assert!(check_rulebook(&gen_rulebook(&file)).is_ok());
+    let rules: Vec<String> = (0 .. 32768).map(|i| format!("(F{}) = (C{})", i, i)).collect();
+    let file = read_file(&rules.join("\n")).unwrap();
+    assert!(check_rulebook(&gen_rulebook(&file)).is_err());
+  }
+
   #[test]
   fn test_rulebook_expected() {
     let file = "
@@ -659,7 +695,7 @@ pub fn subst(term: &mut lang::Term, sub_name: &str, value: &lang::Term) {
         subst(&mut *arg, sub_name, value);
       }
     }
-    lang::Term::Num { .. } => {}
+    lang::Term::Num { .. } | lang::Term::Flo { .. } => {}
     lang::Term::Op2 { val0, val1, .. } => {
       subst(&mut *val0, sub_name, value);
       subst(&mut *val1, sub_name, value);
@@ -0,0 +1,165 @@
+// Interaction Microbenchmarks
+// ---------------------------
+// `hvm bench --rules` appends this to the runtime template, renaming its main,
+// and runs it next to the same benchmarks on runtime.rs (see bench.rs). Each
+// one fills the heap with `n` redexes of a single interaction, then times
+// rewriting them all, and prints the nanoseconds per redex. Interactions that
+// happen inside reduce() are timed through it, so the time of a reduce() call
+// on a number, the first benchmark, is part of theirs.
+
+#include <time.h>
+
+#define RULE_CALL    (0)
+#define RULE_APP_LAM (1)
+#define RULE_DUP_LAM (2)
+#define RULE_DUP_SUP (3)
+#define RULE_OP2_NUM (4)
+#define RULE_FUN_SUP (5)
+#define RULE_COLLECT (6)
+#define RULE_COUNT   (7)
+
+// A function id that is never called, and the label of the dups and sups
+#define RULE_FID (0x100)
+#define RULE_COL (1)
+
+const char* rule_name[RULE_COUNT] = {
+  "reduce", "APP-LAM", "DUP-LAM", "DUP-SUP", "OP2-NUM", "FUN-SUP", "collect",
+};
+
+// λx(x)
+Ptr rule_id(Worker* mem) {
+  u64 lam = alloc(mem, 2);
+  link(mem, lam + 1, Var(lam));
+  return Lam(lam);
+}
+
+// Builds a redex of the given rule, to be stored on `host`
+Ptr rule_make(Worker* mem, u64 rule) {
+  switch (rule) {
+    // 0
+    case RULE_CALL: {
+      return Num(0);
+    }
+    // (λx(x) 1)
+    case RULE_APP_LAM: {
+      u64 app = alloc(mem, 2);
+      link(mem, app + 0, rule_id(mem));
+      link(mem, app + 1, Num(1));
+      return App(app);
+    }
+    // dup a ~ = λx(x); a
+    case RULE_DUP_LAM: {
+      u64 dup = alloc(mem, 3);
+      link(mem, dup + 1, Era());
+      link(mem, dup + 2, rule_id(mem));
+      return Dp0(RULE_COL, dup);
+    }
+    // dup a ~ = {1 2}; a
+    case RULE_DUP_SUP: {
+      u64 dup = alloc(mem, 3);
+      u64 par = alloc(mem, 2);
+      link(mem, par + 0, Num(1));
+      link(mem, par + 1, Num(2));
+      link(mem, dup + 1, Era());
+      link(mem, dup + 2, Par(RULE_COL, par));
+      return Dp0(RULE_COL, dup);
+    }
+    // (+ 2 3)
+    case RULE_OP2_NUM: {
+      u64 op2 = alloc(mem, 2);
+      link(mem, op2 + 0, Num(2));
+      link(mem, op2 + 1, Num(3));
+      return Op2(ADD, op2);
+    }
+    // (F {1 2} 3)
+    case RULE_FUN_SUP: {
+      u64 fun = alloc(mem, 2);
+      u64 par = alloc(mem, 2);
+      link(mem, par + 0, Num(1));
+      link(mem, par + 1, Num(2));
+      link(mem, fun + 0, Par(RULE_COL, par));
+      link(mem, fun + 1, Num(3));
+      return Cal(2, RULE_FID, fun);
+    }
+    // (K (K 1 2) λx(x)), which is collected
+    default: {
+      u64 ctr0 = alloc(mem, 2);
+      u64 ctr1 = alloc(mem, 2);
+      link(mem, ctr1 + 0, Num(1));
+      link(mem, ctr1 + 1, Num(2));
+      link(mem, ctr0 + 0, Ctr(2, RULE_FID, ctr1));
+      link(mem, ctr0 + 1, rule_id(mem));
+      return Ctr(2, RULE_FID, ctr0);
+    }
+  }
+}
+
+// Empties the heap
+void rule_reset(Worker* mem) {
+  heap_base = 0;
+  heap_next = 0;
+  mem->size = 0;
+  mem->page_pos = 0;
+  mem->page_end = 0;
+  for (u64 a = 0; a < MAX_ARITY; ++a) {
+    mem->free[a] = -1;
+  }
+}
+
+// Nanoseconds per rewrite of `n` redexes of a rule
+double rule_run(Worker* mem, u64 rule, u64 n, u64* hosts) {
+  rule_reset(mem);
+  for (u64 i = 0; i < n; ++i) {
+    hosts[i] = alloc(mem, 1);
+    link(mem, hosts[i], rule_make(mem, rule));
+  }
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (u64 i = 0; i < n; ++i) {
+    Ptr term = ask_lnk(mem, hosts[i]);
+    switch (rule) {
+      case RULE_FUN_SUP: {
+        cal_par(mem, hosts[i], term, ask_arg(mem, term, 0), 0);
+        break;
+      }
+      case RULE_COLLECT: {
+        collect(mem, term);
+        break;
+      }
+      default: {
+        reduce(mem, hosts[i], 1);
+        break;
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  double time = (double)(stop.tv_sec - start.tv_sec) * 1e9 + (double)(stop.tv_nsec - start.tv_nsec);
+  return time / (double)n;
+}
+
+// Usage: `rules <redexes>`. Prints a line per rule, with its name and time.
+int main(int argc, char* argv[]) {
+  u64 n = argc > 1 ? strtoull(argv[1], 0, 10) : 1 << 20;
+
+  Worker mem;
+  memset(&mem, 0, sizeof(Worker));
+  stk_init(&mem.stack);
+  #ifdef PARALLEL
+  deque_init(&mem.deque);
+  #endif
+  workers = &mem;
+  num_workers = 1;
+  heap_words = n * 16 + PAGE_SIZE * 2;
+  mem.node = (u64*)mem_reserve(heap_words * sizeof(u64), 0);
+  u64* hosts = (u64*)malloc(n * sizeof(u64));
+  assert(mem.node && hosts);
+
+  for (u64 rule = 0; rule < RULE_COUNT; ++rule) {
+    printf("%s %.3f\n", rule_name[rule], rule_run(&mem, rule, n, hosts));
+  }
+
+  free(hosts);
+  stk_free(&mem.stack);
+  mem_release(mem.node, heap_words * sizeof(u64));
+  return 0;
+}
@@ -5,18 +5,25 @@
 #include <assert.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 
 /*! GENERATED_PARALLEL_FLAG !*/
 
 #ifdef PARALLEL
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #endif
 
+#if defined(PROFILE) || defined(TRACE)
+#include <time.h>
+#endif
+
 #define LIKELY(x) __builtin_expect((x), 1)
 #define UNLIKELY(x) __builtin_expect((x), 0)
 
@@ -38,26 +45,45 @@ typedef pthread_t Thd;
 #define U64_PER_MB (0x20000)
 #define U64_PER_GB (0x8000000)
 
-// When the program starts, we pre-alloc a big chunk of memory (set by cli flag).
-// This will be replaced by a proper arena allocator soon (see the Issues)!
-#define HEAP_SIZE /*! GENERATED_HEAP_SIZE */ 1 /* GENERATED_HEAP_SIZE !*/
+// When the program starts, we reserve a big chunk of virtual memory, which is
+// only committed as it is touched. These are the defaults for the heap size
+// (set by cli flag) and the number of workers; both can be changed on startup.
+#define DEFAULT_HEAP_SIZE /*! GENERATED_HEAP_SIZE */ 1 /* GENERATED_HEAP_SIZE !*/
 
 #ifdef PARALLEL
-#define MAX_WORKERS (/*! GENERATED_NUM_THREADS */ 1 /* GENERATED_NUM_THREADS !*/)
+#define DEFAULT_WORKERS (/*! GENERATED_NUM_THREADS */ 1 /* GENERATED_NUM_THREADS !*/)
 #else
-#define MAX_WORKERS (1)
+#define DEFAULT_WORKERS (1)
 #endif
 
 #define MAX_DUPS (16777216)
 #define MAX_DYNFUNS (65536)
 #define MAX_ARITY (256)
 
-// Each worker has a fraction of the total.
-#define MEM_SPACE (HEAP_SIZE/sizeof(u64)/MAX_WORKERS)
-#define NORMAL_SEEN_MCAP (HEAP_SIZE/sizeof(u64)/(sizeof(u64)*8))
+// The heap is split in pages, which workers grab from a global pool on demand.
+#define PAGE_SIZE (0x10000)
+
+// Blocks a worker hands over to the shared pool, whenever one of its freelists
+// holds twice as many. Keeps the memory freed by a worker, e.g., one collecting
+// a term deferred by another, from being unusable by the rest.
+#define FREE_SPILL (0x1000)
+
+// Max pending tasks on each worker's deque (must be a power of 2)
+#define DEQUE_SIZE (0x1000)
 
-// Max different colors we're able to readback
-#define DIRS_MCAP (0x10000)
+// Min rewrites a busy worker must perform between two forks. Forks to idle
+// workers are always allowed, so this only limits the creation of tasks that
+// will, most likely, just be popped back by their owner.
+#define NORMAL_FORK_COST (0x400)
+
+// Failed steal rounds after which an idle worker sleeps until a task is pushed
+#define IDLE_SPINS (0x100)
+
+// Max forks on each worker that may be waiting for their children at once
+#define JOIN_SIZE (0x400)
+
+// Nodes a collection frees before checking if it can hand the rest over
+#define COLLECT_BATCH (0x10000)
 
 // Terms
 // -----
@@ -67,14 +93,21 @@ typedef pthread_t Thd;
 // APP * TAG | 137` creates a pointer to an app node stored on position 137.
 // Some links deal with variables: DP0, DP1, VAR, ARG and ERA.  The OP2 link
 // represents a numeric operation, and NUM and FLO links represent unboxed nums.
+// A link has a 4-bit tag, a 24-bit ext and a 36-bit val, which is a position
+// (or, on NUM and FLO, takes the ext bits too and stores a 60-bit number; a FLO
+// is a double with the 4 least significant bits of its mantissa dropped). The ext is
+// the color of DP0, DP1 and SUP, and the operator of OP2. On CTR and FUN, it
+// holds a 16-bit function id and, on its top 8 bits, the arity, so the size of
+// a node is known without looking it up on a table.
 
 typedef u64 Ptr;
 
 #define VAL ((u64) 1)
-#define EXT ((u64) 0x100000000)
-#define ARI ((u64) 0x100000000000000)
+#define EXT ((u64) 0x1000000000)
+#define ARI ((u64) 0x10000000000000)
 #define TAG ((u64) 0x1000000000000000)
 
+#define VAL_MASK ((u64) 0xFFFFFFFFF)
 #define NUM_MASK ((u64) 0xFFFFFFFFFFFFFFF)
 
 #define DP0 (0x0) // points to the dup node that binds this variable (left side)
@@ -109,6 +142,16 @@ typedef u64 Ptr;
 #define GTN (0xE)
 #define NEQ (0xF)
 
+// Reserved ids
+#define STRING_NIL   (0x2)
+#define STRING_CONS  (0x3)
+#define IO_DONE      (0x4)
+#define IO_DO_INPUT  (0x5)
+#define IO_DO_OUTPUT (0x6)
+#define IO_DO_FETCH  (0x7)
+#define IO_DO_STORE  (0x8)
+#define IO_DO_LOAD   (0x9)
+
 //GENERATED_CONSTRUCTOR_IDS_START//
 /*! GENERATED_CONSTRUCTOR_IDS !*/
 //GENERATED_CONSTRUCTOR_IDS_END//
@@ -131,33 +174,111 @@ typedef struct {
   u64  mcap;
 } Stk;
 
+#ifdef PARALLEL
+// A pending normalization (or reduction to weak head normal form) of the
+// subterm on `host`. When it is done, `pend`, which lives on the stack frame of
+// the forking normal_go or reduce_fork, is decremented. A collection task frees
+// the dead term stored on `host` instead, and nobody waits for it.
+#define TASK_NORMAL  (0)
+#define TASK_REDUCE  (1)
+#define TASK_COLLECT (2)
+
+typedef struct {
+  u64          mode;
+  u64          host;
+  atomic_long* pend;
+} Task;
+
+// A Chase-Lev work-stealing deque. The owner pushes and takes tasks from the
+// bottom, while idle workers steal from the top, getting the oldest (and,
+// usually, biggest) subterms.
+typedef struct {
+  atomic_long top;
+  atomic_long bot;
+  Task        data[DEQUE_SIZE];
+} Deque;
+#endif
+
+#ifdef PROFILE
+// Totals of a rule, or of a builtin interaction (see Profiler)
+typedef struct {
+  u64 count;
+  u64 words;
+  u64 cycles;
+} ProfSlot;
+#endif
+
+#ifdef TRACE
+// A span of a worker's time, or an instant, when `dura` is 0 (see Tracer)
+typedef struct {
+  u64 time;
+  u64 dura;
+  u64 kind;
+  u64 arg;
+} TraceEvent;
+#endif
+
 typedef struct {
   u64  tid;
   Ptr* node;
   u64  size;
-  Stk  free[MAX_ARITY];
+  u64  page_pos;
+  u64  page_end;
+  u64  free[MAX_ARITY];
+  Stk  stack;
   u64  cost;
   u64  dups;
-  u64* aris;
-  u64  funs;
+  u64  dups_base;
 
   #ifdef PARALLEL
-  u64             has_work;
-  pthread_mutex_t has_work_mutex;
-  pthread_cond_t  has_work_signal;
+  u64         free_len[MAX_ARITY];
+  Deque       deque;
+  atomic_long join[JOIN_SIZE];
+  u64         join_size;
+  u64         fork_cost;
+  Thd         thread;
+  #endif
 
-  u64             has_result;
-  pthread_mutex_t has_result_mutex;
-  pthread_cond_t  has_result_signal;
+  #ifdef PROFILE
+  ProfSlot* prof;
+  ProfSlot* prof_open;
+  u64       prof_time;
+  u64       prof_words;
+  u64       prof_mark;
+  #endif
 
-  Thd  thread;
+  #ifdef TRACE
+  TraceEvent* trace;
+  u64         trace_len;
+  u64         trace_spin;
   #endif
 } Worker;
 
 // Globals
 // -------
 
-Worker workers[MAX_WORKERS];
+Worker* workers;
+u64     num_workers;
+
+// Heap size, in words
+u64 heap_words;
+
+// End of the input term, where the first page starts
+u64 heap_base;
+
+// Start of the next page that wasn't grabbed by any worker yet
+#ifdef PARALLEL
+atomic_ulong heap_next;
+#else
+u64 heap_next;
+#endif
+
+// Freelists shared by all workers, made of blocks donated by the ones that had
+// too many (see FREE_SPILL). Donors push whole chains, and takers grab whole
+// lists, so neither can be fooled by a block that was popped and pushed back.
+#ifdef PARALLEL
+atomic_ulong free_pool[MAX_ARITY];
+#endif
 
 // Array
 // -----
@@ -210,13 +331,98 @@ u64 stk_pop(Stk* stack) {
   }
 }
 
-u64 stk_find(Stk* stk, u64 val) {
-  for (u64 i = 0; i < stk->size; ++i) {
-    if (stk->data[i] == val) {
-      return i;
+// Map
+// ---
+// A hash map from u64 keys to u64 values, with linear probing.
+
+typedef struct {
+  u64* keys; // key + 1, or 0 on empty slots
+  u64* vals;
+  u64  size;
+  u64  bits; // log2 of the number of slots
+} Map;
+
+void map_init(Map* map) {
+  map->size = 0;
+  map->bits = 4;
+  map->keys = (u64*)calloc((u64)1 << map->bits, sizeof(u64));
+  map->vals = (u64*)malloc(((u64)1 << map->bits) * sizeof(u64));
+  assert(map->keys && map->vals);
+}
+
+void map_free(Map* map) {
+  free(map->keys);
+  free(map->vals);
+}
+
+u64 map_slot(Map* map, u64 key) {
+  u64 mask = ((u64)1 << map->bits) - 1;
+  u64 slot = (key * 0x9E3779B97F4A7C15) >> (64 - map->bits);
+  while (map->keys[slot] != 0 && map->keys[slot] != key + 1) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+// Returns the value of `key`, or -1 if it isn't on the map
+u64 map_get(Map* map, u64 key) {
+  u64 slot = map_slot(map, key);
+  return map->keys[slot] != 0 ? map->vals[slot] : -1;
+}
+
+void map_set(Map* map, u64 key, u64 val) {
+  // Doubles the slots when half of them are used
+  if (UNLIKELY(2 * (map->size + 1) > ((u64)1 << map->bits))) {
+    u64* keys = map->keys;
+    u64* vals = map->vals;
+    u64  mcap = (u64)1 << map->bits;
+    map->bits += 1;
+    map->keys = (u64*)calloc((u64)1 << map->bits, sizeof(u64));
+    map->vals = (u64*)malloc(((u64)1 << map->bits) * sizeof(u64));
+    assert(map->keys && map->vals);
+    for (u64 i = 0; i < mcap; ++i) {
+      if (keys[i] != 0) {
+        u64 slot = map_slot(map, keys[i] - 1);
+        map->keys[slot] = keys[i];
+        map->vals[slot] = vals[i];
+      }
     }
+    free(keys);
+    free(vals);
+  }
+  u64 slot = map_slot(map, key);
+  if (map->keys[slot] == 0) {
+    map->keys[slot] = key + 1;
+    map->size += 1;
+  }
+  map->vals[slot] = val;
+}
+
+// Virtual Memory
+// --------------
+
+// Reserves `size` bytes of zeroed memory. Pages are only committed by the OS
+// when first touched, so short runs don't pay for the maximum heap. With
+// `huge`, asks the OS to back it with transparent huge pages, if supported.
+void* mem_reserve(u64 size, u8 huge) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  #ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+  #endif
+  void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (data == MAP_FAILED) {
+    return NULL;
   }
-  return -1;
+  #ifdef MADV_HUGEPAGE
+  if (huge) {
+    madvise(data, size, MADV_HUGEPAGE);
+  }
+  #endif
+  return data;
+}
+
+void mem_release(void* data, u64 size) {
+  munmap(data, size);
 }
 
 // Memory
@@ -263,17 +469,28 @@ Ptr Num(u64 val) {
   return (NUM * TAG) | (val & NUM_MASK);
 }
 
+Ptr Flo(u64 val) {
+  return (FLO * TAG) | (val & NUM_MASK);
+}
+
+// The 60-bit representation of a double
+u64 flo_val(double x) {
+  u64 bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return bits >> 4;
+}
+
 Ptr Nil(void) {
   return NIL * TAG;
 }
 
 Ptr Ctr(u64 ari, u64 fun, u64 pos) {
-  return (CTR * TAG) | (fun * EXT) | pos;
+  return (CTR * TAG) | (ari * ARI) | (fun * EXT) | pos;
 }
 
 // FIXME: update name to Fun
 Ptr Cal(u64 ari, u64 fun, u64 pos) {
-  return (FUN * TAG) | (fun * EXT) | pos;
+  return (FUN * TAG) | (ari * ARI) | (fun * EXT) | pos;
 }
 
 u64 get_tag(Ptr lnk) {
@@ -285,30 +502,51 @@ u64 get_ext(Ptr lnk) {
 }
 
 u64 get_val(Ptr lnk) {
-  return lnk & 0xFFFFFFFF;
+  return lnk & VAL_MASK;
+}
+
+// The function id of a CTR or FUN link
+u64 get_fun(Ptr lnk) {
+  return (lnk / EXT) & 0xFFFF;
 }
 
 u64 get_num(Ptr lnk) {
   return lnk & 0xFFFFFFFFFFFFFFF;
 }
 
-//u64 get_ari(Ptr lnk) {
-  //return (lnk / ARI) & 0xF;
-//}
+// The arity of a CTR or FUN link
+u64 get_ari(Ptr lnk) {
+  return (lnk / ARI) & 0xFF;
+}
+
+double get_flo(Ptr lnk) {
+  u64 bits = get_num(lnk) << 4;
+  double x;
+  memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+// A NUM or FLO link as a double
+double get_real(Ptr lnk) {
+  return get_tag(lnk) == FLO ? get_flo(lnk) : (double) get_num(lnk);
+}
+
+// Remainder of a truncated division. Written out, so that binaries don't need
+// libm; doubles past 2^52 have no fractional part anyway.
+double flo_mod(double a, double b) {
+  double q = a / b;
+  if (q > -4503599627370496.0 && q < 4503599627370496.0) {
+    q = (double)(int64_t) q;
+  }
+  return a - b * q;
+}
 
 u64 get_loc(Ptr lnk, u64 arg) {
   return get_val(lnk) + arg;
 }
 
 u64 ask_ari(Worker* mem, Ptr lnk) {
-  u64 fid = get_ext(lnk);
-  u64 got = fid < mem->funs ? mem->aris[fid] : 0;
-  // TODO: remove this in a future update where ari will be removed from the lnk
-  //if (get_ari(lnk) != got) {
-    //printf("[ERROR] arity inconsistency\n");
-    //exit(1);
-  //}
-  return got;
+  return get_ari(lnk);
 }
 
 // Dereferences a Ptr, getting what is stored on its target position
@@ -334,25 +572,88 @@ u64 link(Worker* mem, u64 loc, Ptr lnk) {
   return lnk;
 }
 
-// Allocates a block of memory, up to 16 words long
+// Grabs a fresh page from the global pool. Pages aren't owned by any worker,
+// so a busy worker may use as much of the heap as it needs.
+void alloc_page(Worker* mem) {
+  #ifdef PARALLEL
+  u64 page = atomic_fetch_add_explicit(&heap_next, PAGE_SIZE, memory_order_relaxed);
+  #else
+  u64 page = heap_next;
+  heap_next += PAGE_SIZE;
+  #endif
+  if (UNLIKELY(page >= heap_words)) {
+    fprintf(stderr, "Out of memory: heap of %"PRIu64" words exhausted.\n", (u64)heap_words);
+    exit(1);
+  }
+  mem->page_pos = page;
+  mem->page_end = page + PAGE_SIZE < heap_words ? page + PAGE_SIZE : heap_words;
+}
+
+// Allocates a block of memory, up to MAX_ARITY words long
 u64 alloc(Worker* mem, u64 size) {
   if (UNLIKELY(size == 0)) {
     return 0;
   } else {
-    u64 reuse = stk_pop(&mem->free[size]);
+    #ifdef PROFILE
+    mem->prof_words += size;
+    #endif
+    u64 reuse = mem->free[size];
+    #ifdef PARALLEL
+    if (reuse == -1 && atomic_load_explicit(&free_pool[size], memory_order_relaxed) != -1) {
+      reuse = atomic_exchange_explicit(&free_pool[size], -1, memory_order_acquire);
+    }
+    #endif
     if (reuse != -1) {
+      mem->free[size] = mem->node[reuse + size - 1];
+      #ifdef PARALLEL
+      mem->free_len[size] -= mem->free_len[size] > 0;
+      #endif
       return reuse;
     }
-    u64 loc = mem->size;
+    if (UNLIKELY(mem->page_pos + size > mem->page_end)) {
+      alloc_page(mem);
+    }
+    u64 loc = mem->page_pos;
+    mem->page_pos += size;
     mem->size += size;
-    return mem->tid * MEM_SPACE + loc;
-    //return __atomic_fetch_add(&mem->nodes->size, size, __ATOMIC_RELAXED);
+    return loc;
+  }
+}
+
+#ifdef PARALLEL
+// Moves the FREE_SPILL most recently freed blocks of a size to the shared pool.
+// `free_len` counts the blocks freed since the list was last empty, minus the
+// ones taken since, so the list holds at least that many; blocks taken from
+// the pool aren't counted, to avoid walking them.
+void free_spill(Worker* mem, u64 size) {
+  u64 head = mem->free[size];
+  u64 tail = head;
+  for (u64 i = 1; i < FREE_SPILL; ++i) {
+    tail = mem->node[tail + size - 1];
   }
+  mem->free[size] = mem->node[tail + size - 1];
+  mem->free_len[size] -= FREE_SPILL;
+  u64 next = atomic_load_explicit(&free_pool[size], memory_order_relaxed);
+  do {
+    mem->node[tail + size - 1] = next;
+  } while (!atomic_compare_exchange_weak_explicit(&free_pool[size], &next, head, memory_order_release, memory_order_relaxed));
 }
+#endif
 
-// Frees a block of memory by adding its position a freelist
+// Frees a block of memory by adding its position a freelist. The freelists are
+// linked through the last word of each free block, rather than the first, as
+// other workers may still touch the dup lock on the first word of a dup node.
+// Callers must not read a block after freeing it.
 void clear(Worker* mem, u64 loc, u64 size) {
-  stk_push(&mem->free[size], loc);
+  if (size > 0) {
+    mem->node[loc + size - 1] = mem->free[size];
+    mem->free[size] = loc;
+    #ifdef PARALLEL
+    if (UNLIKELY(++mem->free_len[size] >= 2 * FREE_SPILL)) {
+      free_spill(mem, size);
+    }
+    #endif
+  }
 }
 
 // Garbage Collection
@@ -365,59 +666,81 @@ void clear(Worker* mem, u64 loc, u64 size) {
 // mostly irrelevant in practice. Absolute GC-freedom, though, requires
 // uncommenting the `reduce` lines below, but this would make HVM not 100% lazy
 // in some cases, so it should be called in a separate thread.
+// The traversal keeps pending subterms on the worker's stack, so freeing a
+// long list or a deep tree can't overflow the C stack. After each batch of
+// COLLECT_BATCH nodes, the rest of a big term may be handed to an idle worker.
+#ifdef PARALLEL
+u8 collect_defer(Worker* mem, Ptr term);
+#endif
+
 void collect(Worker* mem, Ptr term) {
-  switch (get_tag(term)) {
-    case DP0: {
-      link(mem, get_loc(term,0), Era());
-      //reduce(mem, get_loc(ask_arg(mem,term,1),0));
-      break;
-    }
-    case DP1: {
-      link(mem, get_loc(term,1), Era());
-      //reduce(mem, get_loc(ask_arg(mem,term,0),0));
-      break;
-    }
-    case VAR: {
-      link(mem, get_loc(term,0), Era());
-      break;
+  Stk* stack = &mem->stack;
+  u64  base  = stack->size;
+  #ifdef PARALLEL
+  u64  done  = 0;
+  #endif
+
+  while (1) {
+
+    #ifdef PARALLEL
+    if (++done % COLLECT_BATCH == 0 && collect_defer(mem, term)) {
+      term = Era();
     }
-    case LAM: {
-      if (get_tag(ask_arg(mem,term,0)) != ERA) {
-        link(mem, get_loc(ask_arg(mem,term,0),0), Era());
+    #endif
+
+    switch (get_tag(term)) {
+      case DP0: {
+        link(mem, get_loc(term,0), Era());
+        //reduce(mem, get_loc(ask_arg(mem,term,1),0));
+        break;
       }
-      collect(mem, ask_arg(mem,term,1));
-      clear(mem, get_loc(term,0), 2);
-      break;
-    }
-    case APP: {
-      collect(mem, ask_arg(mem,term,0));
-      collect(mem, ask_arg(mem,term,1));
-      clear(mem, get_loc(term,0), 2);
-      break;
-    }
-    case SUP: {
-      collect(mem, ask_arg(mem,term,0));
-      collect(mem, ask_arg(mem,term,1));
-      clear(mem, get_loc(term,0), 2);
-      break;
-    }
-    case OP2: {
-      collect(mem, ask_arg(mem,term,0));
-      collect(mem, ask_arg(mem,term,1));
-      clear(mem, get_loc(term,0), 2);
-      break;
-    }
-    case NUM: {
-      break;
-    }
-    case CTR: case FUN: {
-      u64 arity = ask_ari(mem, term);
-      for (u64 i = 0; i < arity; ++i) {
-        collect(mem, ask_arg(mem,term,i));
+      case DP1: {
+        link(mem, get_loc(term,1), Era());
+        //reduce(mem, get_loc(ask_arg(mem,term,0),0));
+        break;
+      }
+      case VAR: {
+        link(mem, get_loc(term,0), Era());
+        break;
+      }
+      case LAM: {
+        if (get_tag(ask_arg(mem,term,0)) != ERA) {
+          link(mem, get_loc(ask_arg(mem,term,0),0), Era());
+        }
+        Ptr body = ask_arg(mem,term,1);
+        clear(mem, get_loc(term,0), 2);
+        term = body;
+        continue;
+      }
+      case APP: case SUP: case OP2: {
+        stk_push(stack, ask_arg(mem,term,0));
+        Ptr arg1 = ask_arg(mem,term,1);
+        clear(mem, get_loc(term,0), 2);
+        term = arg1;
+        continue;
+      }
+      case NUM: case FLO: {
+        break;
+      }
+      case CTR: case FUN: {
+        u64 arity = ask_ari(mem, term);
+        if (arity > 0) {
+          for (u64 i = 0; i < arity - 1; ++i) {
+            stk_push(stack, ask_arg(mem,term,i));
+          }
+          Ptr last = ask_arg(mem,term,arity-1);
+          clear(mem, get_loc(term,0), arity);
+          term = last;
+          continue;
+        }
+        break;
       }
-      clear(mem, get_loc(term,0), arity);
+    }
+
+    if (stack->size == base) {
       break;
     }
+    term = stk_pop(stack);
   }
 }
 
@@ -432,6 +755,248 @@ u64 gen_dupk(Worker* mem) {
   return mem->dups++ & 0xFFFFFF;
 }
 
+// Profiler
+// --------
+// Built with -DPROFILE, the runtime counts how often each rule of each function
+// fires, and each builtin interaction, along with the words it allocates and
+// the cycles it takes, until the reducer moves on. That includes collecting the
+// garbage it makes, but not reducing its strict arguments. Workers fill their
+// own tables, which are merged at the end, and printed after the statistics.
+// Otherwise, PROF and PROF_STOP expand to nothing.
+
+// Builtin interactions, on the first slots of the table
+#define PROF_APP_LAM    (0)
+#define PROF_APP_SUP    (1)
+#define PROF_DUP_LAM    (2)
+#define PROF_DUP_SUP_EQ (3)
+#define PROF_DUP_SUP_NE (4)
+#define PROF_DUP_NUM    (5)
+#define PROF_DUP_CTR    (6)
+#define PROF_DUP_ERA    (7)
+#define PROF_OP2_NUM    (8)
+#define PROF_OP2_FLO    (9)
+#define PROF_OP2_SUP_0  (10)
+#define PROF_OP2_SUP_1  (11)
+#define PROF_FUN_SUP    (12)
+#define PROF_KINDS      (13)
+
+// Then, each function gets PROF_RULES slots: the first for its native version,
+// and one per rule. Rules past the last slot share it.
+#define PROF_RULES (32)
+#define PROF_RULE(fid, rule) (PROF_KINDS + (fid) * PROF_RULES + ((rule) + 1 < PROF_RULES ? (rule) + 1 : PROF_RULES - 1))
+
+#ifdef PROFILE
+
+const char* prof_kind_name[PROF_KINDS] = {
+  "APP-LAM", "APP-SUP", "DUP-LAM", "DUP-SUP (equal)", "DUP-SUP (different)",
+  "DUP-NUM", "DUP-CTR", "DUP-ERA", "OP2-NUM", "OP2-FLO", "OP2-SUP-0",
+  "OP2-SUP-1", "FUN-SUP",
+};
+
+// Slots on each table, set by main, and the merged table
+u64       prof_size;
+ProfSlot* prof_total;
+
+// Cycles, on x86, or nanoseconds elsewhere
+static inline u64 prof_clock() {
+  #if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+  #else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (u64)t.tv_sec * 1000000000 + (u64)t.tv_nsec;
+  #endif
+}
+
+// Charges the time and words since the last prof_start to its slot
+static inline void prof_stop(Worker* mem) {
+  if (mem->prof_open) {
+    mem->prof_open->cycles += prof_clock() - mem->prof_time;
+    mem->prof_open->words += mem->prof_words - mem->prof_mark;
+    mem->prof_open = NULL;
+  }
+}
+
+static inline void prof_start(Worker* mem, u64 slot) {
+  prof_stop(mem);
+  mem->prof_open = &mem->prof[slot];
+  mem->prof_open->count += 1;
+  mem->prof_mark = mem->prof_words;
+  mem->prof_time = prof_clock();
+}
+
+#define PROF(mem, slot) prof_start(mem, slot)
+#define PROF_STOP(mem) prof_stop(mem)
+
+// Sums the workers' tables into prof_total, freeing them
+void prof_merge() {
+  prof_total = (ProfSlot*)calloc(prof_size, sizeof(ProfSlot));
+  assert(prof_total);
+  for (u64 t = 0; t < num_workers; ++t) {
+    for (u64 i = 0; i < prof_size; ++i) {
+      prof_total[i].count += workers[t].prof[i].count;
+      prof_total[i].words += workers[t].prof[i].words;
+      prof_total[i].cycles += workers[t].prof[i].cycles;
+    }
+    free(workers[t].prof);
+    workers[t].prof = NULL;
+  }
+}
+
+int prof_cmp(const void* a, const void* b) {
+  u64 ca = prof_total[*(u64*)a].cycles;
+  u64 cb = prof_total[*(u64*)b].cycles;
+  return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+// Prints every slot that was used, the most expensive first
+void prof_report(FILE* out, char** id_to_name_data, u64 id_to_name_size) {
+  u64* used = (u64*)malloc(prof_size * sizeof(u64));
+  u64  len = 0;
+  u64  sum = 0;
+  assert(used);
+  for (u64 i = 0; i < prof_size; ++i) {
+    if (prof_total[i].count > 0) {
+      used[len++] = i;
+      sum += prof_total[i].cycles;
+    }
+  }
+  qsort(used, len, sizeof(u64), prof_cmp);
+  fprintf(out, "\n");
+  fprintf(out, "%14s %14s %16s %10s %7s  %s\n", "Count", "Words", "Cycles", "Cyc/Count", "Share", "Rule");
+  for (u64 k = 0; k < len; ++k) {
+    ProfSlot* slot = &prof_total[used[k]];
+    fprintf(out, "%14"PRIu64" %14"PRIu64" %16"PRIu64" %10.1f %6.2f%%  ",
+      slot->count, slot->words, slot->cycles,
+      (double)slot->cycles / (double)slot->count,
+      sum > 0 ? 100.0 * (double)slot->cycles / (double)sum : 0.0);
+    if (used[k] < PROF_KINDS) {
+      fprintf(out, "%s\n", prof_kind_name[used[k]]);
+    } else {
+      u64 fid  = (used[k] - PROF_KINDS) / PROF_RULES;
+      u64 rule = (used[k] - PROF_KINDS) % PROF_RULES;
+      char* name = fid < id_to_name_size && id_to_name_data[fid] ? id_to_name_data[fid] : "?";
+      if (rule == 0) {
+        fprintf(out, "%s (native)\n", name);
+      } else if (rule == PROF_RULES - 1) {
+        fprintf(out, "%s #%d+\n", name, PROF_RULES - 2);
+      } else {
+        fprintf(out, "%s #%"PRIu64"\n", name, rule - 1);
+      }
+    }
+  }
+  free(used);
+}
+
+#else
+
+#define PROF(mem, slot)
+#define PROF_STOP(mem)
+
+#endif
+
+// Tracer
+// ------
+// Built with -DTRACE, workers record what they spend their time on: running
+// each task, waiting for the tasks they forked, looking for work, waiting for a
+// compaction and spinning on dup locks. Each worker keeps its last TRACE_SIZE
+// events in a ring buffer. At exit, they're written to a Chrome trace file
+// (`trace.json`, or the one given with `-P`), which chrome://tracing and
+// ui.perfetto.dev can open, with one track per worker.
+
+#define TRACE_NORMAL  (0) // a normalization task
+#define TRACE_REDUCE  (1) // a reduction task
+#define TRACE_COLLECT (2) // a collection task
+#define TRACE_RUN     (3) // the root normalization
+#define TRACE_FORK    (4) // an instant, with the number of pushed tasks
+#define TRACE_JOIN    (5) // waiting for forked tasks, running some meanwhile
+#define TRACE_IDLE    (6) // looking for a task to steal
+#define TRACE_PAUSE   (7) // waiting for a compaction
+#define TRACE_SPIN    (8) // waiting for a dup lock
+#define TRACE_KINDS   (9)
+
+// Events kept per worker (must be a power of 2)
+#define TRACE_SIZE (0x10000)
+
+#ifdef TRACE
+
+const char* trace_kind_name[TRACE_KINDS] = {
+  "normal", "reduce", "collect", "run", "fork", "join", "idle", "pause", "spin",
+};
+
+char* trace_path = "trace.json";
+u64   trace_base;
+
+static inline u64 trace_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (u64)t.tv_sec * 1000000000 + (u64)t.tv_nsec;
+}
+
+// Records an event that started at `time` and ends now, overwriting the
+// oldest one when the buffer is full
+void trace_push(Worker* mem, u64 kind, u64 time, u64 arg) {
+  TraceEvent* event = &mem->trace[mem->trace_len++ & (TRACE_SIZE - 1)];
+  event->time = time;
+  event->dura = kind == TRACE_FORK ? 0 : trace_now() - time;
+  event->kind = kind;
+  event->arg  = arg;
+}
+
+// A failed dup lock starts a spin, and the next taken one ends it
+static inline void trace_spin_start(Worker* mem) {
+  if (!mem->trace_spin) {
+    mem->trace_spin = trace_now();
+  }
+}
+
+static inline void trace_spin_stop(Worker* mem, u64 loc) {
+  if (mem->trace_spin) {
+    trace_push(mem, TRACE_SPIN, mem->trace_spin, loc);
+    mem->trace_spin = 0;
+  }
+}
+
+// Writes the workers' events, in microseconds since the run started
+u8 trace_save(char* path) {
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    return 0;
+  }
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (u64 t = 0; t < num_workers; ++t) {
+    Worker* mem = &workers[t];
+    u64 lost = mem->trace_len > TRACE_SIZE ? mem->trace_len - TRACE_SIZE : 0;
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%"PRIu64",\"args\":{\"name\":\"worker %"PRIu64" (%"PRIu64" events lost)\"}},\n", t, t, lost);
+    for (u64 i = lost; i < mem->trace_len; ++i) {
+      TraceEvent* event = &mem->trace[i & (TRACE_SIZE - 1)];
+      double time = (double)(event->time - trace_base) / 1000.0;
+      fprintf(file, "{\"name\":\"%s\",\"pid\":0,\"tid\":%"PRIu64",\"ts\":%.3f,", trace_kind_name[event->kind], t, time);
+      if (event->kind == TRACE_FORK) {
+        fprintf(file, "\"ph\":\"i\",\"s\":\"t\",\"args\":{\"tasks\":%"PRIu64"}},\n", event->arg);
+      } else {
+        fprintf(file, "\"ph\":\"X\",\"dur\":%.3f,\"args\":{\"loc\":%"PRIu64"}},\n", (double)event->dura / 1000.0, event->arg);
+      }
+    }
+  }
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"hvm\"}}\n]}\n");
+  return fclose(file) == 0;
+}
+
+#define TRACE_TIME(name) u64 name = trace_now()
+#define TRACE_SPAN(mem, kind, time, arg) trace_push(mem, kind, time, arg)
+#define TRACE_SPIN_START(mem) trace_spin_start(mem)
+#define TRACE_SPIN_STOP(mem, loc) trace_spin_stop(mem, loc)
+
+#else
+
+#define TRACE_TIME(name)
+#define TRACE_SPAN(mem, kind, time, arg)
+#define TRACE_SPIN_START(mem)
+#define TRACE_SPIN_STOP(mem, loc)
+
+#endif
+
 // Performs a `x <- value` substitution. It just calls link if the substituted
 // value is a term. If it is an ERA node, that means `value` is now unreachable,
 // so we just call the collector.
@@ -451,8 +1016,9 @@ void subst(Worker* mem, Ptr lnk, Ptr val) {
 // {(F a0 b0 c0 ...) (F a1 b1 c1 ...)}
 Ptr cal_par(Worker* mem, u64 host, Ptr term, Ptr argn, u64 n) {
   inc_cost(mem);
+  PROF(mem, PROF_FUN_SUP);
   u64 arit = ask_ari(mem, term);
-  u64 func = get_ext(term);
+  u64 func = get_fun(term);
   u64 fun0 = get_loc(term, 0);
   u64 fun1 = alloc(mem, arit);
   u64 par0 = get_loc(argn, 0);
@@ -475,16 +1041,38 @@ Ptr cal_par(Worker* mem, u64 host, Ptr term, Ptr argn, u64 n) {
   return done;
 }
 
-// Reduces a term to weak head normal form.
+// Natives
+// -------
+
+// Purely numeric functions also get a plain C version over u64. Past this
+// depth, it gives up and leaves the call to the graph reducer.
+#define NATIVE_DEPTH (0x8000)
+
+// Set once a function's native version fails, so it keeps to the graph path.
+// Workers only ever set it, so a stale read just costs one more attempt.
+u8 native_off[MAX_DYNFUNS];
+
+//GENERATED_NATIVE_FUNCTIONS_START//
+/*! GENERATED_NATIVE_FUNCTIONS !*/
+//GENERATED_NATIVE_FUNCTIONS_END//
+
+#ifdef PARALLEL
+u8 reduce_fork(Worker* mem, u64* locs, u64 size);
+#endif
+
+// Reduces a term to weak head normal form. Pending hosts are kept on the
+// worker's stack, above the entries of any caller, which are left untouched.
 Ptr reduce(Worker* mem, u64 root, u64 slen) {
-  Stk stack;
-  stk_init(&stack);
+  Stk* stack = &mem->stack;
+  u64  base  = stack->size;
 
   u64 init = 1;
-  u32 host = (u32)root;
+  u64 host = root;
 
   while (1) {
 
+    PROF_STOP(mem);
+
     u64 term = ask_lnk(mem, host);
 
     //printf("reduce "); debug_print_lnk(term); printf("\n");
@@ -497,7 +1085,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
     if (init == 1) {
       switch (get_tag(term)) {
         case APP: {
-          stk_push(&stack, host);
+          stk_push(stack, host);
           //stack[size++] = host;
           init = 1;
           host = get_loc(term, 0);
@@ -509,8 +1097,10 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
           // TODO: reason about this, comment
           atomic_flag* flag = ((atomic_flag*)(mem->node + get_loc(term,0))) + 6;
           if (atomic_flag_test_and_set(flag) != 0) {
+            TRACE_SPIN_START(mem);
             continue;
           }
+          TRACE_SPIN_STOP(mem, get_loc(term, 0));
 
           // Term changed before we locked
           if (term != ask_lnk(mem, host)) {
@@ -519,23 +1109,30 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
           }
           #endif
 
-          stk_push(&stack, host);
+          stk_push(stack, host);
           host = get_loc(term, 2);
           continue;
         }
         case OP2: {
-          if (slen == 1 || stack.size > 0) {
-            stk_push(&stack, host);
-            stk_push(&stack, get_loc(term, 0) | 0x80000000);
+          if (slen == 1 || stack->size > base) {
+            #ifdef PARALLEL
+            u64 locs[2] = {get_loc(term, 0), get_loc(term, 1)};
+            if (reduce_fork(mem, locs, 2)) {
+              init = 0;
+              continue;
+            }
+            #endif
+            stk_push(stack, host);
+            stk_push(stack, get_loc(term, 0) | 0x8000000000000000);
             //stack[size++] = host;
-            //stack[size++] = get_loc(term, 0) | 0x80000000;
+            //stack[size++] = get_loc(term, 0) | 0x8000000000000000;
             host = get_loc(term, 1);
             continue;
           }
           break;
         }
         case FUN: {
-          u64 fun = get_ext(term);
+          u64 fun = get_fun(term);
           u64 ari = ask_ari(mem, term);
 
           switch (fun)
@@ -563,6 +1160,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
             case LAM: {
               //printf("app-lam\n");
               inc_cost(mem);
+              PROF(mem, PROF_APP_LAM);
               subst(mem, ask_arg(mem, arg0, 0), ask_arg(mem, term, 1));
               u64 done = link(mem, host, ask_arg(mem, arg0, 1));
               clear(mem, get_loc(term,0), 2);
@@ -578,6 +1176,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
             case SUP: {
               //printf("app-sup\n");
               inc_cost(mem);
+              PROF(mem, PROF_APP_SUP);
               u64 app0 = get_loc(term, 0);
               u64 app1 = get_loc(arg0, 0);
               u64 let0 = alloc(mem, 3);
@@ -611,6 +1210,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
             case LAM: {
               //printf("dup-lam\n");
               inc_cost(mem);
+              PROF(mem, PROF_DUP_LAM);
               u64 let0 = get_loc(term, 0);
               u64 par0 = get_loc(arg0, 0);
               u64 lam0 = alloc(mem, 2);
@@ -647,6 +1247,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
               //printf("dup-sup\n");
               if (get_ext(term) == get_ext(arg0)) {
                 inc_cost(mem);
+                PROF(mem, PROF_DUP_SUP_EQ);
                 subst(mem, ask_arg(mem,term,0), ask_arg(mem,arg0,0));
                 subst(mem, ask_arg(mem,term,1), ask_arg(mem,arg0,1));
                 u64 done = link(mem, host, ask_arg(mem, arg0, get_tag(term) == DP0 ? 0 : 1));
@@ -656,6 +1257,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
                 continue;
               } else {
                 inc_cost(mem);
+                PROF(mem, PROF_DUP_SUP_NE);
                 u64 par0 = alloc(mem, 2);
                 u64 let0 = get_loc(term,0);
                 u64 par1 = get_loc(arg0,0);
@@ -682,9 +1284,10 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
             // x <- N
             // y <- N
             // ~
-            case NUM: {
+            case NUM: case FLO: {
               //printf("dup-u32\n");
               inc_cost(mem);
+              PROF(mem, PROF_DUP_NUM);
               subst(mem, ask_arg(mem,term,0), arg0);
               subst(mem, ask_arg(mem,term,1), arg0);
               clear(mem, get_loc(term,0), 3);
@@ -704,7 +1307,8 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
             case CTR: {
               //printf("dup-ctr\n");
               inc_cost(mem);
-              u64 func = get_ext(arg0);
+              PROF(mem, PROF_DUP_CTR);
+              u64 func = get_fun(arg0);
               u64 arit = ask_ari(mem, arg0);
               if (arit == 0) {
                 subst(mem, ask_arg(mem,term,0), Ctr(0, func, 0));
@@ -740,6 +1344,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
             // y <- *
             case ERA: {
               inc_cost(mem);
+              PROF(mem, PROF_DUP_ERA);
               subst(mem, ask_arg(mem, term, 0), Era());
               subst(mem, ask_arg(mem, term, 1), Era());
               link(mem, host, Era());
@@ -765,6 +1370,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
           if (get_tag(arg0) == NUM && get_tag(arg1) == NUM) {
             //printf("op2-u32\n");
             inc_cost(mem);
+            PROF(mem, PROF_OP2_NUM);
             u64 a = get_num(arg0);
             u64 b = get_num(arg1);
             u64 c = 0;
@@ -791,6 +1397,35 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
             link(mem, host, done);
           }
 
+          // (+ a b), with a float on either side
+          // ------------------------------------ OP2-FLO
+          // add(a, b)
+          else if ((get_tag(arg0) == FLO || get_tag(arg1) == FLO)
+                && (get_tag(arg0) == FLO || get_tag(arg0) == NUM)
+                && (get_tag(arg1) == FLO || get_tag(arg1) == NUM)
+                && (get_ext(term) <= MOD || get_ext(term) >= LTN)) {
+            inc_cost(mem);
+            PROF(mem, PROF_OP2_FLO);
+            double a = get_real(arg0);
+            double b = get_real(arg1);
+            u64 done = 0;
+            switch (get_ext(term)) {
+              case ADD: done = Flo(flo_val(a + b)); break;
+              case SUB: done = Flo(flo_val(a - b)); break;
+              case MUL: done = Flo(flo_val(a * b)); break;
+              case DIV: done = Flo(flo_val(a / b)); break;
+              case MOD: done = Flo(flo_val(flo_mod(a, b))); break;
+              case LTN: done = Num(a <  b ? 1 : 0); break;
+              case LTE: done = Num(a <= b ? 1 : 0); break;
+              case EQL: done = Num(a == b ? 1 : 0); break;
+              case GTE: done = Num(a >= b ? 1 : 0); break;
+              case GTN: done = Num(a >  b ? 1 : 0); break;
+              case NEQ: done = Num(a != b ? 1 : 0); break;
+            }
+            clear(mem, get_loc(term,0), 2);
+            link(mem, host, done);
+          }
+
           // (+ {a0 a1} b)
           // --------------------- OP2-SUP-0
           // let b0 b1 = b
@@ -798,6 +1433,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
           else if (get_tag(arg0) == SUP) {
             //printf("op2-sup-0\n");
             inc_cost(mem);
+            PROF(mem, PROF_OP2_SUP_0);
             u64 op20 = get_loc(term, 0);
             u64 op21 = get_loc(arg0, 0);
             u64 let0 = alloc(mem, 3);
@@ -820,6 +1456,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
           else if (get_tag(arg1) == SUP) {
             //printf("op2-sup-1\n");
             inc_cost(mem);
+            PROF(mem, PROF_OP2_SUP_1);
             u64 op20 = get_loc(term, 0);
             u64 op21 = get_loc(arg1, 0);
             u64 let0 = alloc(mem, 3);
@@ -838,7 +1475,7 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
           break;
         }
         case FUN: {
-          u64 fun = get_ext(term);
+          u64 fun = get_fun(term);
           u64 ari = ask_ari(mem, term);
 
           switch (fun)
@@ -853,511 +1490,1691 @@ Ptr reduce(Worker* mem, u64 root, u64 slen) {
       }
     }
 
-    u64 item = stk_pop(&stack);
-    if (item == -1) {
+    if (stack->size == base) {
       break;
     } else {
-      init = item >> 31;
-      host = item & 0x7FFFFFFF;
+      u64 item = stk_pop(stack);
+      init = item >> 63;
+      host = item & 0x7FFFFFFFFFFFFFFF;
       continue;
     }
 
   }
 
+  PROF_STOP(mem);
   return ask_lnk(mem, root);
 }
 
-// sets the nth bit of a bit-array represented as a u64 array
-void set_bit(u64* bits, u64 bit) {
-  bits[bit >> 6] |= (1ULL << (bit & 0x3f));
+#ifdef PARALLEL
+
+// Task Scheduler
+// --------------
+// Each worker owns a deque of pending subterm normalizations. normal_go pushes
+// the children of a node to its own deque, normalizes the first one itself,
+// and then helps with other tasks until all of its children are done. Idle
+// workers steal tasks from the top of other workers' deques, and sleep when
+// there is nothing to steal for a while, until the next push wakes them.
+
+atomic_long normal_idle;   // number of workers looking for a task
+atomic_long normal_stop;   // set when the workers must halt
+atomic_long normal_pause;  // set while the heap is being compacted
+atomic_long normal_paused; // number of workers waiting for the compaction
+atomic_long normal_parked; // number of idle workers asleep on normal_wake
+
+pthread_mutex_t normal_park_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  normal_wake      = PTHREAD_COND_INITIALIZER;
+
+void deque_init(Deque* deque) {
+  atomic_store_explicit(&deque->top, 0, memory_order_relaxed);
+  atomic_store_explicit(&deque->bot, 0, memory_order_relaxed);
 }
 
-// gets the nth bit of a bit-array represented as a u64 array
-u8 get_bit(u64* bits, u64 bit) {
-  return (bits[bit >> 6] >> (bit & 0x3F)) & 1;
+// Wakes one parked worker, or all of them. The fence pairs with the one in
+// task_park: either the parked worker sees what we published before calling
+// this (a task, a stop or a pause), or we see it parked and signal it.
+void task_wake(u8 all) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&normal_parked, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&normal_park_lock);
+    if (all) {
+      pthread_cond_broadcast(&normal_wake);
+    } else {
+      pthread_cond_signal(&normal_wake);
+    }
+    pthread_mutex_unlock(&normal_park_lock);
+  }
 }
 
-#ifdef PARALLEL
-void normal_fork(u64 tid, u64 host, u64 sidx, u64 slen);
-u64  normal_join(u64 tid);
-#endif
+// Pushes a task to the bottom. Returns 0 if the deque is full.
+u8 deque_push(Deque* deque, Task task) {
+  long b = atomic_load_explicit(&deque->bot, memory_order_relaxed);
+  long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+  if (b - t >= DEQUE_SIZE) {
+    return 0;
+  }
+  deque->data[b & (DEQUE_SIZE - 1)] = task;
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bot, b + 1, memory_order_relaxed);
+  task_wake(0);
+  return 1;
+}
 
-u64 normal_seen_data[NORMAL_SEEN_MCAP];
+// Takes the most recently pushed task. Only called by the owner.
+u8 deque_take(Deque* deque, Task* task) {
+  long b = atomic_load_explicit(&deque->bot, memory_order_relaxed) - 1;
+  atomic_store_explicit(&deque->bot, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+  if (t > b) {
+    atomic_store_explicit(&deque->bot, b + 1, memory_order_relaxed);
+    return 0;
+  }
+  *task = deque->data[b & (DEQUE_SIZE - 1)];
+  if (t == b) {
+    u8 won = atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&deque->bot, b + 1, memory_order_relaxed);
+    return won;
+  }
+  return 1;
+}
 
-void normal_init(void) {
-  for (u64 i = 0; i < NORMAL_SEEN_MCAP; ++i) {
-    normal_seen_data[i] = 0;
+// Steals the oldest task. Called by any worker.
+u8 deque_steal(Deque* deque, Task* task) {
+  long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&deque->bot, memory_order_acquire);
+  if (t >= b) {
+    return 0;
   }
+  *task = deque->data[t & (DEQUE_SIZE - 1)];
+  return atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
 }
 
-Ptr normal_go(Worker* mem, u64 host, u64 sidx, u64 slen) {
-  Ptr term = ask_lnk(mem, host);
-  //printf("normal %llu %llu | ", sidx, slen); debug_print_lnk(term); printf("\n");
-  if (get_bit(normal_seen_data, host)) {
-    return term;
-  } else {
-    term = reduce(mem, host, slen);
-    set_bit(normal_seen_data, host);
-    u64 rec_size = 0;
-    u64 rec_locs[16];
-    switch (get_tag(term)) {
-      case LAM: {
-        rec_locs[rec_size++] = get_loc(term,1);
-        break;
-      }
-      case APP: {
-        rec_locs[rec_size++] = get_loc(term,0);
-        rec_locs[rec_size++] = get_loc(term,1);
-        break;
-      }
-      case SUP: {
-        rec_locs[rec_size++] = get_loc(term,0);
-        rec_locs[rec_size++] = get_loc(term,1);
-        break;
-      }
-      case DP0: {
-        rec_locs[rec_size++] = get_loc(term,2);
-        break;
-      }
-      case DP1: {
-        rec_locs[rec_size++] = get_loc(term,2);
-        break;
-      }
-      case OP2: {
-        if (slen > 1) {
-          rec_locs[rec_size++] = get_loc(term,0);
-          rec_locs[rec_size++] = get_loc(term,1);
-          break;
-        }
-      }
-      case CTR: case FUN: {
-        u64 arity = (u64)ask_ari(mem, term);
-        for (u64 i = 0; i < arity; ++i) {
-          rec_locs[rec_size++] = get_loc(term,i);
-        }
-        break;
-      }
+// Tries to steal a task from any other worker
+u8 task_steal(Worker* mem, Task* task) {
+  for (u64 i = 1; i < num_workers; ++i) {
+    if (deque_steal(&workers[(mem->tid + i) % num_workers].deque, task)) {
+      return 1;
     }
-    #ifdef PARALLEL
+  }
+  return 0;
+}
 
-    //printf("ue %llu %llu\n", rec_size, slen);
+// Sleeps until a task is pushed, or the workers are paused or stopped. Called
+// by idle workers after spinning for a while, so that sequential phases, like
+// IO or streamed readback, don't keep every core busy.
+void task_park(Worker* mem) {
+  pthread_mutex_lock(&normal_park_lock);
+  atomic_fetch_add(&normal_parked, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  for (;;) {
+    if (atomic_load(&normal_stop) || atomic_load(&normal_pause)) {
+      break;
+    }
+    u8 found = 0;
+    for (u64 i = 1; i < num_workers && !found; ++i) {
+      Deque* deque = &workers[(mem->tid + i) % num_workers].deque;
+      found = atomic_load(&deque->top) < atomic_load(&deque->bot);
+    }
+    if (found) {
+      break;
+    }
+    pthread_cond_wait(&normal_wake, &normal_park_lock);
+  }
+  atomic_fetch_sub(&normal_parked, 1);
+  pthread_mutex_unlock(&normal_park_lock);
+}
+
+// Takes a task pushed after `mark`, i.e., one that belongs to the caller frame
+u8 task_take_own(Worker* mem, long mark, Task* task) {
+  if (atomic_load_explicit(&mem->deque.bot, memory_order_relaxed) <= mark) {
+    return 0;
+  }
+  return deque_take(&mem->deque, task);
+}
+
+Ptr normal_go(Worker* mem, u64 host, u64 slen);
 
-    if (rec_size >= 2 && slen >= rec_size) {
+// Runs a task, and signals its completion
+void task_run(Worker* mem, Task task) {
+  TRACE_TIME(time);
+  switch (task.mode) {
+    case TASK_NORMAL: {
+      link(mem, task.host, normal_go(mem, task.host, num_workers));
+      break;
+    }
+    case TASK_REDUCE: {
+      reduce(mem, task.host, 1);
+      break;
+    }
+    case TASK_COLLECT: {
+      collect(mem, task.host);
+      TRACE_SPAN(mem, TRACE_COLLECT, time, task.host);
+      return;
+    }
+  }
+  TRACE_SPAN(mem, task.mode == TASK_NORMAL ? TRACE_NORMAL : TRACE_REDUCE, time, task.host);
+  atomic_fetch_sub_explicit(task.pend, 1, memory_order_release);
+}
+
+// Forks when some worker is idle, or when this worker did enough work since
+// its last fork; otherwise, the subterms are cheaper to handle inline.
+u8 task_should_fork(Worker* mem) {
+  return atomic_load_explicit(&normal_idle, memory_order_relaxed) > 0
+      || mem->cost - mem->fork_cost >= NORMAL_FORK_COST;
+}
 
-      u64 space = slen / rec_size;
+// Waits until every other worker is paused, and runs the tasks left on our own
+// deque. Only called by the root normalizer, when none of its forks is pending,
+// so all that other workers may be running is a collection.
+void task_pause(Worker* mem) {
+  TRACE_TIME(time);
+  atomic_store(&normal_pause, 1);
+  task_wake(1);
+  Task task;
+  while (atomic_load(&normal_paused) < num_workers - 1) {
+    if (deque_take(&mem->deque, &task)) {
+      task_run(mem, task);
+    } else {
+      sched_yield();
+    }
+  }
+  while (deque_take(&mem->deque, &task)) {
+    task_run(mem, task);
+  }
+  TRACE_SPAN(mem, TRACE_PAUSE, time, 0);
+}
+
+void task_resume(void) {
+  atomic_store(&normal_pause, 0);
+}
+
+// Hands the rest of a big dead term over to an idle worker, so that the caller
+// can go back to reducing. Returns 0, keeping it, when every worker is busy.
+u8 collect_defer(Worker* mem, Ptr term) {
+  if (atomic_load_explicit(&normal_idle, memory_order_relaxed) == 0) {
+    return 0;
+  }
+  Task task = { .mode = TASK_COLLECT, .host = term, .pend = NULL };
+  return deque_push(&mem->deque, task);
+}
+
+// Is it worth to spawn a task for this subterm? Unboxed values, variables and
+// nullary constructors are already normal, so there is nothing to be done.
+u8 normal_worth_fork(Worker* mem, Ptr term) {
+  switch (get_tag(term)) {
+    case VAR: case ARG: case ERA: case NUM: case FLO: {
+      return 0;
+    }
+    case CTR: {
+      return ask_ari(mem, term) > 0;
+    }
+    default: {
+      return 1;
+    }
+  }
+}
+
+// Is this subterm a redex, i.e., does reducing it to WHNF take any work?
+u8 reduce_worth_fork(Ptr term) {
+  switch (get_tag(term)) {
+    case DP0: case DP1: case APP: case OP2: case FUN: {
+      return 1;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
 
-      for (u64 i = 1; i < rec_size; ++i) {
-        //printf("spawn %llu %llu\n", sidx + i * space, space);
-        normal_fork(sidx + i * space, rec_locs[i], sidx + i * space, space);
+// Reduces the strict arguments on `locs` to WHNF in parallel. The first redex
+// is reduced inline, the others are pushed to this worker's deque. Returns 0,
+// without doing anything, when less than 2 arguments are redexes, or when
+// forking isn't worth it; the caller must then reduce them sequentially.
+// While waiting, this only runs its own tasks: the caller may hold dup locks
+// that unrelated tasks need, so helping them could deadlock.
+u8 reduce_fork(Worker* mem, u64* locs, u64 size) {
+  if (!task_should_fork(mem)) {
+    return 0;
+  }
+  u64 redexes = 0;
+  for (u64 i = 0; i < size; ++i) {
+    redexes += reduce_worth_fork(ask_lnk(mem, locs[i]));
+  }
+  if (redexes < 2) {
+    return 0;
+  }
+
+  atomic_long pend;
+  atomic_init(&pend, 0);
+  mem->fork_cost = mem->cost;
+  long mark = atomic_load_explicit(&mem->deque.bot, memory_order_relaxed);
+
+  u64 first = size;
+  for (u64 i = 0; i < size; ++i) {
+    if (reduce_worth_fork(ask_lnk(mem, locs[i]))) {
+      if (first == size) {
+        first = i;
+        continue;
       }
+      atomic_fetch_add_explicit(&pend, 1, memory_order_relaxed);
+      Task task = { .mode = TASK_REDUCE, .host = locs[i], .pend = &pend };
+      if (!deque_push(&mem->deque, task)) {
+        atomic_fetch_sub_explicit(&pend, 1, memory_order_relaxed);
+        reduce(mem, locs[i], 1);
+      }
+    }
+  }
+  TRACE_TIME(time);
+  TRACE_SPAN(mem, TRACE_FORK, time, atomic_load_explicit(&pend, memory_order_relaxed));
+
+  reduce(mem, locs[first], 1);
+
+  #ifdef TRACE
+  time = trace_now();
+  #endif
+  while (atomic_load_explicit(&pend, memory_order_acquire) > 0) {
+    Task task;
+    if (task_take_own(mem, mark, &task)) {
+      task_run(mem, task);
+    } else {
+      sched_yield();
+    }
+  }
+  TRACE_SPAN(mem, TRACE_JOIN, time, locs[first]);
+
+  return 1;
+}
+
+#endif
+
+// Normalizer
+// ----------
+// Terms are trees, except for dup nodes, whose body is reachable from both
+// DP0 and DP1. The seen set records the dup bodies that were already entered,
+// so that they're only normalized once. Each of its words stores the epoch of
+// the normalization that wrote it on the high half and 32 seen bits on the low
+// half, so a new normalization clears it just by bumping the epoch.
+
+u64* normal_seen_data;
+u64  normal_seen_mcap;
+u64  normal_seen_epoch;
+
+void normal_init(void) {
+  normal_seen_epoch += 1;
+  // The epoch wrapped around: clears the words that were used so far. Words
+  // past the last grabbed page, which may not even be committed yet, are zero.
+  if (normal_seen_epoch > 0xFFFFFFFF) {
+    u64 used = (heap_next + 31) / 32;
+    memset(normal_seen_data, 0, (used < normal_seen_mcap ? used : normal_seen_mcap) * sizeof(u64));
+    normal_seen_epoch = 1;
+  }
+}
+
+// Adds a location to the seen set. Returns 1 if it was already there.
+u8 normal_seen_add(u64 loc) {
+  u64* word  = &normal_seen_data[loc >> 5];
+  u64  mask  = 1ULL << (loc & 0x1F);
+  u64  epoch = normal_seen_epoch << 32;
+  #ifdef PARALLEL
+  u64 old = __atomic_load_n(word, __ATOMIC_RELAXED);
+  while (1) {
+    u64 bits = (old & 0xFFFFFFFF00000000) == epoch ? old : epoch;
+    if (bits & mask) {
+      return 1;
+    }
+    if (__atomic_compare_exchange_n(word, &old, bits | mask, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      return 0;
+    }
+  }
+  #else
+  u64 bits = (*word & 0xFFFFFFFF00000000) == epoch ? *word : epoch;
+  *word = bits | mask;
+  return (bits & mask) != 0;
+  #endif
+}
 
-      link(mem, rec_locs[0], normal_go(mem, rec_locs[0], sidx, space));
+// Entries of the normalizer on the worker's stack. VISIT reduces a location
+// and schedules its children. With slen > 1, reduce() leaves OP2 nodes alone,
+// so that their operands are normalized (and forked) like constructor fields;
+// REDUCE_OP2 then reduces the node itself, once the operands are done. JOIN
+// waits for the forked children of a node, counted on `mem->join[idx]`.
+#define NORMAL_VISIT      (0)
+#define NORMAL_REDUCE_OP2 (1)
+#define NORMAL_JOIN       (2)
+
+void normal_push(Worker* mem, u64 kind, u64 val) {
+  stk_push(&mem->stack, (val << 2) | kind);
+}
 
-      for (u64 i = 1; i < rec_size; ++i) {
-        link(mem, get_loc(term, i), normal_join(sidx + i * space));
+// Is this location on the seen set?
+u8 normal_seen_has(u64 loc) {
+  u64 word = normal_seen_data[loc >> 5];
+  return (word >> 32) == normal_seen_epoch && ((word >> (loc & 0x1F)) & 1);
+}
+
+// Compaction
+// ----------
+// After a long run, live nodes are scattered over the heap, since alloc()
+// prefers reusing freed blocks. Compaction copies the term on `host`, in depth
+// first order, to a scratch area, and then slides it back to `heap_base`.
+// Every Ptr is rewritten, and the Arg back-pointers on lambdas and dups are
+// rebuilt by linking their variables again, so unreachable binders become
+// erased. The pending entries of the normalizer are moved along. It must only
+// run while no other worker is reducing; `host` itself stays put.
+
+u64 compact_rate; // rewrites between compactions (0 disables them)
+u64 compact_next; // cost of the root worker at the next compaction
+
+// Words of the block a Ptr points to
+u64 compact_block_size(Worker* mem, Ptr term) {
+  switch (get_tag(term)) {
+    case LAM: case APP: case SUP: case OP2: return 2;
+    case DP0: case DP1: return 3;
+    case CTR: case FUN: return ask_ari(mem, term);
+    default: return 0;
+  }
+}
+
+// Compacts the heap. Returns 0, changing nothing, if the scratch area is full.
+u8 compact(Worker* mem, u64 host) {
+  u64  used = heap_next < heap_words ? heap_next : heap_words;
+  u64* dest = (u64*)mem_reserve(heap_words * sizeof(u64), 0); // indexed by new location
+  u64* move = (u64*)mem_reserve(used * sizeof(u64), 0);       // new location + 1, by old location
+  assert(dest && move);
+
+  Stk* stack = &mem->stack;
+  u64  base  = stack->size;
+  u64  size  = heap_base;
+  u8   done  = 1;
+  Ptr  root  = Era();
+  Stk  seen;
+  Stk  vars;
+  stk_init(&seen);
+  stk_init(&vars);
+
+  // Pending (slot, Ptr) pairs, where the slot is already a new location
+  stk_push(stack, host);
+  stk_push(stack, ask_lnk(mem, host));
+  while (stack->size > base) {
+    Ptr term = stk_pop(stack);
+    u64 slot = stk_pop(stack);
+    u64 tag  = get_tag(term);
+    u64 ari  = compact_block_size(mem, term);
+
+    if (ari > 0) {
+      u64 old = get_loc(term, 0);
+      if (move[old] == 0) {
+        if (size + ari > heap_words) {
+          done = 0;
+          stack->size = base;
+          break;
+        }
+        u64 loc = size;
+        size += ari;
+        for (u64 i = 0; i < ari; ++i) {
+          move[old + i] = loc + i + 1;
+        }
+        // Binders are erased until their variables are linked
+        u64 from = 0;
+        if (tag == LAM) {
+          dest[loc + 0] = Era();
+          from = 1;
+        } else if (tag == DP0 || tag == DP1) {
+          dest[loc + 0] = Era();
+          dest[loc + 1] = Era();
+          from = 2;
+          if (normal_seen_has(old + 2)) {
+            stk_push(&seen, loc + 2);
+          }
+        }
+        for (u64 i = ari; i-- > from;) {
+          stk_push(stack, loc + i);
+          stk_push(stack, ask_lnk(mem, old + i));
+        }
       }
+      term = (term & ~VAL_MASK) | (move[old] - 1);
+    } else if (tag == VAR) {
+      // Variables may escape their lambdas' bodies, through superpositions,
+      // so their lambdas may not have been reached yet
+      u64 lam = get_loc(term, 0);
+      if (move[lam] == 0) {
+        stk_push(&vars, slot);
+        stk_push(&vars, lam);
+        continue;
+      }
+      term = Var(move[lam] - 1);
+    }
+
+    if (slot == host) {
+      root = term;
+    } else {
+      dest[slot] = term;
+    }
+    if (get_tag(term) <= VAR) {
+      dest[get_loc(term, get_tag(term) == DP1 ? 1 : 0)] = Arg(slot);
+    }
+  }
 
+  // Links the variables of lambdas reached late. The others are unreachable.
+  while (done && vars.size > 0) {
+    u64 lam  = stk_pop(&vars);
+    u64 slot = stk_pop(&vars);
+    Ptr term = move[lam] ? Var(move[lam] - 1) : Era();
+    if (slot == host) {
+      root = term;
     } else {
+      dest[slot] = term;
+    }
+    if (move[lam]) {
+      dest[move[lam] - 1] = Arg(slot);
+    }
+  }
+
+  if (done) {
+    memcpy(mem->node + heap_base, dest + heap_base, (size - heap_base) * sizeof(u64));
+    mem->node[host] = root;
 
-      for (u64 i = 0; i < rec_size; ++i) {
-        link(mem, rec_locs[i], normal_go(mem, rec_locs[i], sidx, slen));
+    // Moves the normalizer's pending locations
+    for (u64 i = 0; i < base; ++i) {
+      u64 item = stack->data[i];
+      u64 loc  = item >> 2;
+      if ((item & 3) != NORMAL_JOIN && loc < used && move[loc]) {
+        stack->data[i] = ((move[loc] - 1) << 2) | (item & 3);
       }
+    }
 
+    // Moves the seen set
+    normal_init();
+    for (u64 i = 0; i < seen.size; ++i) {
+      normal_seen_add(seen.data[i]);
     }
-    #else
 
-    for (u64 i = 0; i < rec_size; ++i) {
-      link(mem, rec_locs[i], normal_go(mem, rec_locs[i], sidx, slen));
+    // Everything past the compacted term is free, so the freelists are reset,
+    // and the pages after it are given back to the OS
+    heap_next = size;
+    for (u64 t = 0; t < num_workers; ++t) {
+      workers[t].page_pos = 0;
+      workers[t].page_end = 0;
+      for (u64 a = 0; a < MAX_ARITY; ++a) {
+        workers[t].free[a] = -1;
+        #ifdef PARALLEL
+        workers[t].free_len[a] = 0;
+        #endif
+      }
+    }
+    #ifdef PARALLEL
+    for (u64 a = 0; a < MAX_ARITY; ++a) {
+      atomic_store_explicit(&free_pool[a], -1, memory_order_relaxed);
+    }
+    #endif
+    #ifdef MADV_DONTNEED
+    u64 from = (size * sizeof(u64) + 0xFFF) & ~(u64)0xFFF;
+    u64 upto = (used * sizeof(u64)) & ~(u64)0xFFF;
+    if (from < upto) {
+      madvise((u8*)mem->node + from, upto - from, MADV_DONTNEED);
     }
+    #endif
+  }
 
+  stk_free(&seen);
+  stk_free(&vars);
+  mem_release(dest, heap_words * sizeof(u64));
+  mem_release(move, used * sizeof(u64));
+  return done;
+}
+
+// Compacts the heap, if enough rewrites happened since the last compaction.
+// Only the outermost normalizer of the first worker does that, between two
+// entries, when none of its forks is pending.
+void normal_compact(Worker* mem, u64 host, u64 base) {
+  if (LIKELY(compact_rate == 0 || mem->cost < compact_next || base != 0 || mem->tid != 0)) {
+    return;
+  }
+  #ifdef PARALLEL
+  if (mem->join_size > 0) {
+    return;
+  }
+  task_pause(mem);
+  #endif
+  compact(mem, host);
+  compact_next = mem->cost + compact_rate;
+  #ifdef PARALLEL
+  task_resume();
+  #endif
+}
+
+// Normalizes the term on `host`, in a single traversal.
+Ptr normal_go(Worker* mem, u64 host, u64 slen) {
+  Stk* stack = &mem->stack;
+  u64  base  = stack->size;
+
+  normal_push(mem, NORMAL_VISIT, host);
+
+  while (stack->size > base) {
+    normal_compact(mem, host, base);
+
+    u64 item = stk_pop(stack);
+    u64 kind = item & 3;
+    u64 loc  = item >> 2;
+
+    #ifdef PARALLEL
+    // Helps other workers until the children forked by a node are done
+    if (kind == NORMAL_JOIN) {
+      TRACE_TIME(time);
+      while (atomic_load_explicit(&mem->join[loc], memory_order_acquire) > 0) {
+        Task task;
+        if (deque_take(&mem->deque, &task) || task_steal(mem, &task)) {
+          task_run(mem, task);
+        } else {
+          sched_yield();
+        }
+      }
+      TRACE_SPAN(mem, TRACE_JOIN, time, host);
+      mem->join_size -= 1;
+      continue;
+    }
+    #endif
+
+    // If the operands were stuck, so is the node, and its children are done.
+    // Otherwise, the result is visited as usual.
+    if (kind == NORMAL_REDUCE_OP2) {
+      Ptr term = ask_lnk(mem, loc);
+      if (reduce(mem, loc, 1) != term) {
+        normal_push(mem, NORMAL_VISIT, loc);
+      }
+      continue;
+    }
+
+    Ptr term = reduce(mem, loc, slen);
+    //printf("normal %llu | ", slen); debug_print_lnk(term); printf("\n");
+
+    u64 rec_size = 0;
+    u64 rec_from = 0;
+    switch (get_tag(term)) {
+      case LAM: {
+        rec_from = 1;
+        rec_size = 1;
+        break;
+      }
+      case APP: case SUP: {
+        rec_size = 2;
+        break;
+      }
+      case DP0: case DP1: {
+        if (!normal_seen_add(get_loc(term, 2))) {
+          rec_from = 2;
+          rec_size = 1;
+        }
+        break;
+      }
+      case OP2: {
+        if (slen > 1) {
+          normal_push(mem, NORMAL_REDUCE_OP2, loc);
+        }
+        rec_size = 2;
+        break;
+      }
+      case CTR: case FUN: {
+        rec_size = ask_ari(mem, term);
+        break;
+      }
+    }
+
+    #ifdef PARALLEL
+    if (rec_size >= 2 && slen > 1 && mem->join_size < JOIN_SIZE && task_should_fork(mem)) {
+
+      u64 join = mem->join_size++;
+      atomic_init(&mem->join[join], 0);
+      mem->fork_cost = mem->cost;
+      normal_push(mem, NORMAL_JOIN, join);
+
+      // Pushes the children in reverse order, so that the owner takes the
+      // leftmost first, and thieves steal the rightmost, bigger chunks. The
+      // first one, and those not worth a task, are visited by this worker.
+      for (u64 i = rec_size; i-- > 0;) {
+        u64 child = get_loc(term, rec_from + i);
+        if (i > 0 && normal_worth_fork(mem, ask_lnk(mem, child))) {
+          atomic_fetch_add_explicit(&mem->join[join], 1, memory_order_relaxed);
+          Task task = { .mode = TASK_NORMAL, .host = child, .pend = &mem->join[join] };
+          if (deque_push(&mem->deque, task)) {
+            continue;
+          }
+          atomic_fetch_sub_explicit(&mem->join[join], 1, memory_order_relaxed);
+        }
+        normal_push(mem, NORMAL_VISIT, child);
+      }
+      #ifdef TRACE
+      trace_push(mem, TRACE_FORK, trace_now(), atomic_load_explicit(&mem->join[join], memory_order_relaxed));
+      #endif
+
+      continue;
+    }
     #endif
 
-    return term;
+    for (u64 i = rec_size; i-- > 0;) {
+      normal_push(mem, NORMAL_VISIT, get_loc(term, rec_from + i));
+    }
   }
+
+  return ask_lnk(mem, host);
 }
 
-Ptr normal(Worker* mem, u64 host, u64 sidx, u64 slen) {
-  // In order to allow parallelization of numeric operations, reduce() will treat OP2 as a CTR if
-  // there is enough thread space. So, for example, normalizing a recursive "sum" function with 4
-  // threads might return something like `(+ (+ 64 64) (+ 64 64))`. reduce() will treat the first
-  // 2 layers as CTRs, allowing normal() to parallelize them. So, in order to finish the reduction,
-  // we call `normal_go()` a second time, with no thread space, to eliminate lasting redexes.
+Ptr normal(Worker* mem, u64 host, u64 slen) {
   normal_init();
-  normal_go(mem, host, sidx, slen);
-  u64 done;
-  u64 cost = mem->cost;
+  return normal_go(mem, host, slen);
+}
+
+#ifdef PARALLEL
+
+// The normalizer worker. It steals tasks from other workers until stopped.
+void *worker(void *arg) {
+  u64 tid = (u64)arg;
+  Worker* mem = &workers[tid];
+  atomic_fetch_add(&normal_idle, 1);
+  TRACE_TIME(idle);
+  u64 spins = 0;
+  while (!atomic_load_explicit(&normal_stop, memory_order_relaxed)) {
+    Task task;
+    if (atomic_load(&normal_pause)) {
+      TRACE_TIME(time);
+      atomic_fetch_add(&normal_paused, 1);
+      while (atomic_load(&normal_pause)) {
+        sched_yield();
+      }
+      atomic_fetch_sub(&normal_paused, 1);
+      TRACE_SPAN(mem, TRACE_PAUSE, time, 0);
+    } else if (task_steal(mem, &task)) {
+      TRACE_SPAN(mem, TRACE_IDLE, idle, 0);
+      atomic_fetch_sub(&normal_idle, 1);
+      task_run(mem, task);
+      // Finishes the tasks that were forked, but not stolen, meanwhile
+      while (deque_take(&mem->deque, &task)) {
+        task_run(mem, task);
+      }
+      atomic_fetch_add(&normal_idle, 1);
+      #ifdef TRACE
+      idle = trace_now();
+      #endif
+      spins = 0;
+    } else if (++spins < IDLE_SPINS) {
+      sched_yield();
+    } else {
+      task_park(mem);
+      spins = 0;
+    }
+  }
+  TRACE_SPAN(mem, TRACE_IDLE, idle, 0);
+  atomic_fetch_sub(&normal_idle, 1);
+  return 0;
+}
+
+#endif
+
+// IO
+// --
+// If Main reduces to an IO action, performs it, and keeps going with the
+// continuation, until it reaches IO.done. Strings are read from the heap
+// straight into a byte buffer, as UTF-8. Stdout is only flushed before reading
+// stdin, so programs that print a lot don't pay for a syscall per output.
+
+typedef struct {
+  char* data;
+  u64   size;
+  u64   mcap;
+} Buf;
+
+void buf_push(Buf* buf, char chr) {
+  if (UNLIKELY(buf->size == buf->mcap)) {
+    buf->mcap = buf->mcap * 2 + 64;
+    buf->data = (char*)realloc(buf->data, buf->mcap);
+    assert(buf->data);
+  }
+  buf->data[buf->size++] = chr;
+}
+
+void buf_push_utf8(Buf* buf, u64 chr) {
+  if (chr < 0x80) {
+    buf_push(buf, chr);
+  } else if (chr < 0x800) {
+    buf_push(buf, 0xC0 | (chr >> 6));
+    buf_push(buf, 0x80 | (chr & 0x3F));
+  } else if (chr < 0x10000) {
+    buf_push(buf, 0xE0 | (chr >> 12));
+    buf_push(buf, 0x80 | ((chr >> 6) & 0x3F));
+    buf_push(buf, 0x80 | (chr & 0x3F));
+  } else {
+    buf_push(buf, 0xF0 | ((chr >> 18) & 0x07));
+    buf_push(buf, 0x80 | ((chr >> 12) & 0x3F));
+    buf_push(buf, 0x80 | ((chr >> 6) & 0x3F));
+    buf_push(buf, 0x80 | (chr & 0x3F));
+  }
+}
+
+// Reduces the string on `host`, appending it to `buf`, with a closing '\0'.
+// Returns 0 if it isn't a string.
+u8 io_read_string(Worker* mem, u64 host, u64 slen, Buf* buf) {
   while (1) {
-    normal_init();
-    done = normal_go(mem, host, 0, 1);
-    if (mem->cost != cost) {
-      cost = mem->cost;
+    Ptr term = reduce(mem, host, slen);
+    if (get_tag(term) != CTR) {
+      return 0;
+    } else if (get_fun(term) == STRING_NIL) {
+      buf_push(buf, '\0');
+      return 1;
+    } else if (get_fun(term) == STRING_CONS) {
+      Ptr chr = reduce(mem, get_loc(term, 0), slen);
+      if (get_tag(chr) != NUM) {
+        return 0;
+      }
+      buf_push_utf8(buf, get_num(chr));
+      host = get_loc(term, 1);
     } else {
+      return 0;
+    }
+  }
+}
+
+// Builds a string from `size` bytes of UTF-8
+Ptr io_make_string(Worker* mem, char* text, u64 size) {
+  Stk chrs;
+  stk_init(&chrs);
+  for (u64 i = 0; i < size;) {
+    u8  head = text[i];
+    u64 len  = head < 0x80 ? 1 : head < 0xE0 ? 2 : head < 0xF0 ? 3 : 4;
+    u64 chr  = len == 1 ? head : head & (0x7F >> len);
+    for (u64 j = 1; j < len && i + j < size; ++j) {
+      chr = (chr << 6) | (text[i + j] & 0x3F);
+    }
+    stk_push(&chrs, chr);
+    i += len;
+  }
+  Ptr term = Ctr(0, STRING_NIL, 0);
+  while (chrs.size > 0) {
+    u64 cons = alloc(mem, 2);
+    link(mem, cons + 0, Num(stk_pop(&chrs)));
+    link(mem, cons + 1, term);
+    term = Ctr(2, STRING_CONS, cons);
+  }
+  stk_free(&chrs);
+  return term;
+}
+
+// Replaces the action on `host` by `(cont argm)`
+void io_continue(Worker* mem, u64 host, Ptr cont, Ptr argm) {
+  u64 app0 = alloc(mem, 2);
+  link(mem, app0 + 0, cont);
+  link(mem, app0 + 1, argm);
+  link(mem, host, App(app0));
+}
+
+void io_type_error(const char* what) {
+  fflush(stdout);
+  fprintf(stderr, "Runtime type error: attempted to %s.\n", what);
+  exit(1);
+}
+
+void io_run(Worker* mem, u64 host, u64 slen) {
+  Buf key = {NULL, 0, 0};
+  Buf val = {NULL, 0, 0};
+  while (1) {
+    Ptr term = reduce(mem, host, slen);
+    if (get_tag(term) != CTR) {
       break;
     }
+    key.size = 0;
+    val.size = 0;
+    switch (get_fun(term)) {
+      // IO.done a : (IO a)
+      case IO_DONE: {
+        Ptr done = ask_arg(mem, term, 0);
+        clear(mem, get_loc(term, 0), 1);
+        link(mem, host, done);
+        printf("\n\n");
+        goto stop;
+      }
+      // IO.do_input (String -> IO a) : (IO a)
+      case IO_DO_INPUT: {
+        fflush(stdout);
+        int chr;
+        while ((chr = getchar()) != EOF && chr != '\n') {
+          buf_push(&val, chr);
+        }
+        if (val.size > 0 && val.data[val.size - 1] == '\r') {
+          val.size -= 1;
+        }
+        Ptr cont = ask_arg(mem, term, 0);
+        clear(mem, get_loc(term, 0), 1);
+        io_continue(mem, host, cont, io_make_string(mem, val.data, val.size));
+        break;
+      }
+      // IO.do_output String (Num -> IO a) : (IO a)
+      case IO_DO_OUTPUT: {
+        if (!io_read_string(mem, get_loc(term, 0), slen, &val)) {
+          io_type_error("print a non-string");
+        }
+        fwrite(val.data, 1, val.size - 1, stdout);
+        Ptr text = ask_arg(mem, term, 0);
+        Ptr cont = ask_arg(mem, term, 1);
+        clear(mem, get_loc(term, 0), 2);
+        collect(mem, text);
+        io_continue(mem, host, cont, Num(0));
+        break;
+      }
+      // IO.do_fetch String Options (String -> IO a) : (IO a)
+      case IO_DO_FETCH: {
+        io_type_error("fetch an URL, which compiled programs can't do");
+        break;
+      }
+      // IO.do_store String String (Num -> IO a) : (IO a)
+      case IO_DO_STORE: {
+        if (!io_read_string(mem, get_loc(term, 0), slen, &key)) {
+          io_type_error("store to a non-string key");
+        }
+        if (!io_read_string(mem, get_loc(term, 1), slen, &val)) {
+          io_type_error("store a non-string");
+        }
+        FILE* file = fopen(key.data, "wb");
+        if (file) {
+          fwrite(val.data, 1, val.size - 1, file);
+          fclose(file);
+        }
+        Ptr name = ask_arg(mem, term, 0);
+        Ptr text = ask_arg(mem, term, 1);
+        Ptr cont = ask_arg(mem, term, 2);
+        clear(mem, get_loc(term, 0), 3);
+        collect(mem, name);
+        collect(mem, text);
+        io_continue(mem, host, cont, Num(0));
+        break;
+      }
+      // IO.do_load String (String -> IO a) : (IO a)
+      case IO_DO_LOAD: {
+        if (!io_read_string(mem, get_loc(term, 0), slen, &key)) {
+          io_type_error("read from a non-string key");
+        }
+        FILE* file = fopen(key.data, "rb");
+        if (!file) {
+          fflush(stdout);
+          fprintf(stderr, "Can't load '%s'.\n", key.data);
+          exit(1);
+        }
+        char chunk[4096];
+        u64  size;
+        while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+          for (u64 i = 0; i < size; ++i) {
+            buf_push(&val, chunk[i]);
+          }
+        }
+        fclose(file);
+        Ptr name = ask_arg(mem, term, 0);
+        Ptr cont = ask_arg(mem, term, 1);
+        clear(mem, get_loc(term, 0), 2);
+        collect(mem, name);
+        io_continue(mem, host, cont, io_make_string(mem, val.data, val.size));
+        break;
+      }
+      default: {
+        goto stop;
+      }
+    }
+  }
+  stop:
+  free(key.data);
+  free(val.data);
+}
+
+u64 ffi_cost;
+u64 ffi_size;
+
+// Set by `-O`, to print the normal form while it's computed (see Streaming)
+typedef struct Stream Stream;
+Stream* stream_to;
+void stream_normal(Worker* mem, u64 host, u64 slen, Stream* stream);
+
+// Set when the heap was loaded from an image (see below)
+typedef struct ImageHead ImageHead;
+ImageHead* heap_image;
+void image_restore(Worker* mem, ImageHead* head);
+
+void ffi_normal(u8* mem_data, u64 mem_size, u64 host) {
+
+  // Init thread objects
+  for (u64 t = 0; t < num_workers; ++t) {
+    workers[t].tid = t;
+    workers[t].size = t == 0 ? (u64)mem_size : 0l;
+    workers[t].page_pos = 0;
+    workers[t].page_end = 0;
+    workers[t].node = (u64*)mem_data;
+    for (u64 a = 0; a < MAX_ARITY; ++a) {
+      workers[t].free[a] = -1;
+    }
+    stk_init(&workers[t].stack);
+    workers[t].cost = 0;
+    workers[t].dups = MAX_DUPS * t / num_workers;
+    #ifdef PROFILE
+    workers[t].prof = (ProfSlot*)calloc(prof_size, sizeof(ProfSlot));
+    assert(workers[t].prof);
+    workers[t].prof_open = NULL;
+    workers[t].prof_words = 0;
+    #endif
+    #ifdef TRACE
+    workers[t].trace = (TraceEvent*)calloc(TRACE_SIZE, sizeof(TraceEvent));
+    assert(workers[t].trace);
+    workers[t].trace_len = 0;
+    workers[t].trace_spin = 0;
+    #endif
+    #ifdef PARALLEL
+    for (u64 a = 0; a < MAX_ARITY; ++a) {
+      workers[t].free_len[a] = 0;
+    }
+    deque_init(&workers[t].deque);
+    workers[t].join_size = 0;
+    workers[t].fork_cost = 0;
+    // workers[t].thread = NULL;
+    #endif
+    if (heap_image) {
+      image_restore(&workers[t], heap_image);
+    }
+    workers[t].dups_base = workers[t].dups;
+  }
+
+  #ifdef PARALLEL
+  for (u64 a = 0; a < MAX_ARITY; ++a) {
+    atomic_store_explicit(&free_pool[a], -1, memory_order_relaxed);
+  }
+  #endif
+
+  // The input term is on the start of the heap, so pages come after it
+  heap_base = (u64)mem_size;
+  heap_next = (u64)mem_size;
+  compact_next = compact_rate;
+
+  // One seen bit per heap location, 32 per word
+  normal_seen_mcap = (heap_words + 31) / 32;
+  normal_seen_data = (u64*)mem_reserve(normal_seen_mcap * sizeof(u64), 0);
+  assert(normal_seen_data);
+
+  #ifdef TRACE
+  trace_base = trace_now();
+  #endif
+
+  // Spawns threads
+  #ifdef PARALLEL
+  atomic_store(&normal_idle, 0);
+  atomic_store(&normal_stop, 0);
+  atomic_store(&normal_pause, 0);
+  atomic_store(&normal_paused, 0);
+  atomic_store(&normal_parked, 0);
+  for (u64 tid = 1; tid < num_workers; ++tid) {
+    pthread_create(&workers[tid].thread, NULL, &worker, (void*)tid);
+  }
+  #endif
+
+  // Performs the IO actions of trm, if any, then normalizes it
+  TRACE_TIME(time);
+  io_run(&workers[0], (u64) host, num_workers);
+  if (stream_to) {
+    stream_normal(&workers[0], (u64) host, num_workers, stream_to);
+  } else {
+    normal(&workers[0], (u64) host, num_workers);
+  }
+  TRACE_SPAN(&workers[0], TRACE_RUN, time, host);
+
+  // Computes total cost and size
+  ffi_cost = 0;
+  ffi_size = 0;
+  for (u64 tid = 0; tid < num_workers; ++tid) {
+    ffi_cost += workers[tid].cost;
+    ffi_size += workers[tid].size;
+  }
+
+  #ifdef PARALLEL
+
+  // Asks workers to stop
+  atomic_store(&normal_stop, 1);
+  task_wake(1);
+
+  // Waits workers to stop
+  for (u64 tid = 1; tid < num_workers; ++tid) {
+    pthread_join(workers[tid].thread, NULL);
+  }
+
+  #endif
+
+  #ifdef PROFILE
+  prof_merge();
+  #endif
+
+  #ifdef TRACE
+  if (!trace_save(trace_path)) {
+    fprintf(stderr, "Can't save trace '%s'.\n", trace_path);
+  }
+  for (u64 tid = 0; tid < num_workers; ++tid) {
+    free(workers[tid].trace);
+  }
+  #endif
+
+  // Clears workers
+  for (u64 tid = 0; tid < num_workers; ++tid) {
+    stk_free(&workers[tid].stack);
+  }
+  mem_release(normal_seen_data, normal_seen_mcap * sizeof(u64));
+}
+
+// Heap Images
+// -----------
+// A heap image is a snapshot of the heap after normalization: a header page,
+// holding the root location, the allocator state and the freelists, followed
+// by the heap words up to `heap_next`. Loading maps these words straight into
+// the start of the heap, copy-on-write, so a big precomputed term costs no
+// reads until it is touched. The freelists of all workers are merged into a
+// single one, so an image can be loaded with any number of workers. The dup
+// labels the image may hold are kept as a list of ranges, so that the workers
+// that load it generate theirs elsewhere: a fresh dup meeting an old one with
+// the same label would annihilate it, rather than commute. Images are tied to
+// the program that saved them, through a hash of its names.
+
+#define IMAGE_MAGIC  (0x32474D494D5648) // "HVMIMG2"
+#define IMAGE_HEAD   (0x10000)          // header bytes, a multiple of any page size
+#define IMAGE_RANGES (64)               // max dup label ranges in an image
+
+struct ImageHead {
+  u64 magic;
+  u64 hash; // hash of the program's constructor and function names
+  u64 root; // location of the normalized term
+  u64 used; // heap words in the image
+  u64 size; // live heap words
+  u64 dups; // number of dup label ranges
+  u64 free[MAX_ARITY];
+  u64 dups_range[IMAGE_RANGES][2]; // [start, end) of the labels in use, sorted
+};
+
+u64 image_hash(char** id_to_name_data, u64 size) {
+  u64 hash = 0xCBF29CE484222325; // FNV-1a
+  for (u64 id = 0; id < size; ++id) {
+    for (char* c = id_to_name_data[id]; *c; ++c) {
+      hash = (hash ^ (u8)*c) * 0x100000001B3;
+    }
+    hash = hash * 0x100000001B3;
+  }
+  return hash;
+}
+
+// Continues from the allocator state of an image. The first worker gets its
+// freelists; the dup labels of all workers are taken from the largest gap
+// between the image's ranges, split as they would be on an empty heap.
+void image_restore(Worker* mem, ImageHead* head) {
+  if (mem->tid == 0) {
+    mem->size = head->size + mem->size - head->used;
+    for (u64 a = 0; a < MAX_ARITY; ++a) {
+      mem->free[a] = head->free[a];
+    }
+  }
+  u64 from = 0;
+  u64 size = head->dups == 0 ? MAX_DUPS : 0;
+  for (u64 i = 0; i < head->dups; ++i) {
+    u64 end  = head->dups_range[i][1];
+    u64 next = i + 1 < head->dups ? head->dups_range[i + 1][0] : head->dups_range[0][0] + MAX_DUPS;
+    if (next - end > size) {
+      from = end;
+      size = next - end;
+    }
+  }
+  mem->dups = from + size * mem->tid / num_workers;
+}
+
+int image_range_cmp(const void* a, const void* b) {
+  u64 x = ((u64*)a)[0];
+  u64 y = ((u64*)b)[0];
+  return x < y ? -1 : x > y;
+}
+
+// Stores the dup labels in use on the image: those of the image the heap was
+// loaded from, if any, and those each worker generated from its first label.
+// Ranges are merged, and, past IMAGE_RANGES, so are the closest ones, which
+// only marks some unused labels as used.
+void image_save_dups(ImageHead* head) {
+  u64 (*range)[2] = (u64(*)[2])malloc((IMAGE_RANGES + num_workers * 2) * sizeof(*range));
+  assert(range);
+  u64 len = 0;
+  if (heap_image) {
+    for (u64 i = 0; i < heap_image->dups; ++i) {
+      range[len][0] = heap_image->dups_range[i][0];
+      range[len][1] = heap_image->dups_range[i][1];
+      ++len;
+    }
+  }
+  for (u64 t = 0; t < num_workers; ++t) {
+    u64 from = workers[t].dups_base & 0xFFFFFF;
+    u64 used = workers[t].dups - workers[t].dups_base;
+    if (used >= MAX_DUPS) {
+      from = 0;
+      used = MAX_DUPS;
+    }
+    // Splits a range that wraps around
+    if (from + used > MAX_DUPS) {
+      range[len][0] = 0;
+      range[len][1] = from + used - MAX_DUPS;
+      ++len;
+      used = MAX_DUPS - from;
+    }
+    if (used > 0) {
+      range[len][0] = from;
+      range[len][1] = from + used;
+      ++len;
+    }
+  }
+  qsort(range, len, sizeof(*range), image_range_cmp);
+  u64 size = 0;
+  for (u64 i = 0; i < len; ++i) {
+    if (size > 0 && range[i][0] <= range[size - 1][1]) {
+      if (range[i][1] > range[size - 1][1]) {
+        range[size - 1][1] = range[i][1];
+      }
+    } else {
+      range[size][0] = range[i][0];
+      range[size][1] = range[i][1];
+      ++size;
+    }
+  }
+  while (size > IMAGE_RANGES) {
+    u64 best = 0;
+    for (u64 i = 1; i + 1 < size; ++i) {
+      if (range[i + 1][0] - range[i][1] < range[best + 1][0] - range[best][1]) {
+        best = i;
+      }
+    }
+    range[best][1] = range[best + 1][1];
+    memmove(&range[best + 1], &range[best + 2], (size - best - 2) * sizeof(*range));
+    --size;
+  }
+  head->dups = size;
+  memcpy(head->dups_range, range, size * sizeof(*range));
+  free(range);
+}
+
+// Saves the heap, normalized by ffi_normal, with its root on `host`
+u8 image_save(char* path, Worker* mem, u64 host, u64 hash) {
+  ImageHead* head = (ImageHead*)calloc(1, IMAGE_HEAD);
+  assert(head);
+  head->magic = IMAGE_MAGIC;
+  head->hash  = hash;
+  head->root  = host;
+  head->used  = heap_next < heap_words ? heap_next : heap_words;
+  head->size  = ffi_size;
+  image_save_dups(head);
+  for (u64 a = 0; a < MAX_ARITY; ++a) {
+    head->free[a] = -1;
+  }
+  // Merges the freelists, linking the last block of each worker's list to the
+  // first block of the next one. The shared pool is moved to the first worker.
+  #ifdef PARALLEL
+  for (u64 a = 1; a < MAX_ARITY; ++a) {
+    u64 loc = atomic_exchange(&free_pool[a], -1);
+    if (loc != -1) {
+      u64 last = loc;
+      while (mem->node[last + a - 1] != -1) {
+        last = mem->node[last + a - 1];
+      }
+      mem->node[last + a - 1] = workers[0].free[a];
+      workers[0].free[a] = loc;
+    }
+  }
+  #endif
+  for (u64 t = num_workers; t-- > 0;) {
+    for (u64 a = 1; a < MAX_ARITY; ++a) {
+      u64 loc = workers[t].free[a];
+      if (loc != -1) {
+        while (mem->node[loc + a - 1] != -1) {
+          loc = mem->node[loc + a - 1];
+        }
+        mem->node[loc + a - 1] = head->free[a];
+        head->free[a] = workers[t].free[a];
+        workers[t].free[a] = -1;
+      }
+    }
+  }
+  FILE* file = fopen(path, "wb");
+  u8 done = file
+    && fwrite(head, IMAGE_HEAD, 1, file) == 1
+    && fwrite(mem->node, sizeof(u64), head->used, file) == head->used;
+  done = file && fclose(file) == 0 && done;
+  free(head);
+  return done;
+}
+
+// Maps an image into the start of `node`, a heap of `heap_words` words, and
+// returns its header, or NULL if the file isn't an image of this program.
+ImageHead* image_load(char* path, u64* node, u64 hash) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  ImageHead* head = (ImageHead*)malloc(sizeof(ImageHead));
+  assert(head);
+  u8 done = fread(head, sizeof(ImageHead), 1, file) == 1
+    && head->magic == IMAGE_MAGIC
+    && head->hash == hash
+    && head->used <= heap_words
+    && head->root < head->used
+    && head->dups <= IMAGE_RANGES
+    && fseek(file, 0, SEEK_END) == 0
+    && (u64)ftell(file) == IMAGE_HEAD + head->used * sizeof(u64);
+  if (done) {
+    void* data = mmap(node, head->used * sizeof(u64), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(file), IMAGE_HEAD);
+    done = data != MAP_FAILED;
+  }
+  fclose(file);
+  if (!done) {
+    free(head);
+    return NULL;
+  }
+  return head;
+}
+
+// Readback
+// --------
+
+// Both passes keep their pending work on explicit stacks, rather than on the C
+// stack, so deep terms, like long lists, can be read back. Variables and dup
+// directions are found through hash maps, so the whole readback is linear.
+
+// Numbers the variables of the term's lambdas, in the order they're printed
+void readback_vars(Map* vars, Worker* mem, Ptr term) {
+  Map seen;
+  Stk next;
+  map_init(&seen);
+  stk_init(&next);
+  stk_push(&next, term);
+  while (next.size > 0) {
+    term = stk_pop(&next);
+    if (map_get(&seen, term) != -1) {
+      continue;
+    }
+    map_set(&seen, term, 0);
+    switch (get_tag(term)) {
+      case LAM: {
+        if (get_tag(ask_arg(mem, term, 0)) != ERA) {
+          map_set(vars, get_loc(term, 0), vars->size);
+        }
+        stk_push(&next, ask_arg(mem, term, 1));
+        break;
+      }
+      case APP: case SUP: case OP2: {
+        stk_push(&next, ask_arg(mem, term, 1));
+        stk_push(&next, ask_arg(mem, term, 0));
+        break;
+      }
+      case DP0: case DP1: {
+        stk_push(&next, ask_arg(mem, term, 2));
+        break;
+      }
+      case CTR: case FUN: {
+        for (u64 i = ask_ari(mem, term); i-- > 0;) {
+          stk_push(&next, ask_arg(mem, term, i));
+        }
+        break;
+      }
+    }
   }
-  return done;
-}
-
-
-#ifdef PARALLEL
-
-// Normalizes in a separate thread
-// Note that, right now, the allocator will just partition the space of the
-// normal form equally among threads, which will not fully use the CPU cores in
-// many cases. A better task scheduler should be implemented. See Issues.
-void normal_fork(u64 tid, u64 host, u64 sidx, u64 slen) {
-  pthread_mutex_lock(&workers[tid].has_work_mutex);
-  workers[tid].has_work = (sidx << 48) | (slen << 32) | host;
-  pthread_cond_signal(&workers[tid].has_work_signal);
-  pthread_mutex_unlock(&workers[tid].has_work_mutex);
+  map_free(&seen);
+  stk_free(&next);
 }
 
-// Waits the result of a forked normalizer
-u64 normal_join(u64 tid) {
-  while (1) {
-    pthread_mutex_lock(&workers[tid].has_result_mutex);
-    while (workers[tid].has_result == -1) {
-      pthread_cond_wait(&workers[tid].has_result_signal, &workers[tid].has_result_mutex);
+// The directions taken on the dup nodes of each color, from the root to the
+// term being printed. A SUP of a color with pending directions is replaced by
+// one of its sides. Stacks are only created for colors that are met.
+typedef struct {
+  Map  cols; // color -> index on data
+  Stk* data;
+  u64  size;
+  u64  mcap;
+} Dirs;
+
+Stk* readback_dirs(Dirs* dirs, u64 col) {
+  u64 idx = map_get(&dirs->cols, col);
+  if (idx == -1) {
+    if (dirs->size == dirs->mcap) {
+      dirs->mcap = dirs->mcap * 2 + 16;
+      dirs->data = (Stk*)realloc(dirs->data, dirs->mcap * sizeof(Stk));
+      assert(dirs->data);
     }
-    u64 done = workers[tid].has_result;
-    workers[tid].has_result = -1;
-    pthread_mutex_unlock(&workers[tid].has_result_mutex);
-    return done;
+    idx = dirs->size++;
+    stk_init(&dirs->data[idx]);
+    map_set(&dirs->cols, col, idx);
   }
+  return &dirs->data[idx];
 }
 
-// Stops a worker
-void worker_stop(u64 tid) {
-  pthread_mutex_lock(&workers[tid].has_work_mutex);
-  workers[tid].has_work = -2;
-  pthread_cond_signal(&workers[tid].has_work_signal);
-  pthread_mutex_unlock(&workers[tid].has_work_mutex);
+void readback_decimal(FILE* out, u64 n) {
+  fprintf(out, "%"PRIu64, n);
 }
 
-// The normalizer worker
-void *worker(void *arg) {
-  u64 tid = (u64)arg;
-  while (1) {
-    pthread_mutex_lock(&workers[tid].has_work_mutex);
-    while (workers[tid].has_work == -1) {
-      pthread_cond_wait(&workers[tid].has_work_signal, &workers[tid].has_work_mutex);
-    }
-    u64 work = workers[tid].has_work;
-    if (work == -2) {
+// Writes the shortest decimal that reads back as the same FLO. It never uses an
+// exponent, and always has a dot, so it doesn't read back as a NUM.
+void readback_flo(FILE* out, u64 val) {
+  u64 bits = val << 4;
+  double x;
+  memcpy(&x, &bits, sizeof(x));
+  if (isnan(x)) {
+    fputs("NaN", out);
+    return;
+  }
+  if (signbit(x)) {
+    fputc('-', out);
+    x = -x;
+  }
+  if (isinf(x)) {
+    fputs("inf", out);
+    return;
+  }
+  char sci[32];
+  for (int prec = 0; prec < 17; ++prec) {
+    snprintf(sci, sizeof(sci), "%.*e", prec, x);
+    if (flo_val(strtod(sci, NULL)) == flo_val(x)) {
       break;
-    } else {
-      u64 sidx = (work >> 48) & 0xFFFF;
-      u64 slen = (work >> 32) & 0xFFFF;
-      u64 host = (work >>  0) & 0xFFFFFFFF;
-      workers[tid].has_result = normal_go(&workers[tid], host, sidx, slen);
-      workers[tid].has_work = -1;
-      pthread_cond_signal(&workers[tid].has_result_signal);
-      pthread_mutex_unlock(&workers[tid].has_work_mutex);
     }
   }
-  return 0;
-}
-
-#endif
-
-u64 ffi_cost;
-u64 ffi_size;
-
-void ffi_normal(u8* mem_data, u32 mem_size, u32 host) {
-
-  // Init thread objects
-  for (u64 t = 0; t < MAX_WORKERS; ++t) {
-    workers[t].tid = t;
-    workers[t].size = t == 0 ? (u64)mem_size : 0l;
-    workers[t].node = (u64*)mem_data;
-    for (u64 a = 0; a < MAX_ARITY; ++a) {
-      stk_init(&workers[t].free[a]);
+  // Splits "d.ddde+XX" into its digits and exponent
+  char digs[32];
+  int  size = 0;
+  char* e = strchr(sci, 'e');
+  for (char* c = sci; c < e; ++c) {
+    if (*c != '.') {
+      digs[size++] = *c;
     }
-    workers[t].cost = 0;
-    workers[t].dups = MAX_DUPS * t / MAX_WORKERS;
-    #ifdef PARALLEL
-    workers[t].has_work = -1;
-    pthread_mutex_init(&workers[t].has_work_mutex, NULL);
-    pthread_cond_init(&workers[t].has_work_signal, NULL);
-    workers[t].has_result = -1;
-    pthread_mutex_init(&workers[t].has_result_mutex, NULL);
-    pthread_cond_init(&workers[t].has_result_signal, NULL);
-    // workers[t].thread = NULL;
-    #endif
   }
-
-  // Spawns threads
-  #ifdef PARALLEL
-  for (u64 tid = 1; tid < MAX_WORKERS; ++tid) {
-    pthread_create(&workers[tid].thread, NULL, &worker, (void*)tid);
+  while (size > 1 && digs[size - 1] == '0') {
+    --size;
   }
-  #endif
-
-  // Normalizes trm
-  normal(&workers[0], (u64) host, 0, MAX_WORKERS);
-
-  // Computes total cost and size
-  ffi_cost = 0;
-  ffi_size = 0;
-  for (u64 tid = 0; tid < MAX_WORKERS; ++tid) {
-    ffi_cost += workers[tid].cost;
-    ffi_size += workers[tid].size;
+  int expo = atoi(e + 1);
+  if (expo < 0) {
+    fputs("0.", out);
+    for (int i = 0; i < -expo - 1; ++i) {
+      fputc('0', out);
+    }
+    fwrite(digs, 1, size, out);
+  } else {
+    for (int i = 0; i <= expo; ++i) {
+      fputc(i < size ? digs[i] : '0', out);
+    }
+    fputc('.', out);
+    if (size <= expo + 1) {
+      fputc('0', out);
+    }
+    for (int i = expo + 1; i < size; ++i) {
+      fputc(digs[i], out);
+    }
   }
+}
 
-  #ifdef PARALLEL
-
-  // Asks workers to stop
-  for (u64 tid = 1; tid < MAX_WORKERS; ++tid) {
-    worker_stop(tid);
+void readback_name(FILE* out, u64 func, char** id_to_name_data, u64 id_to_name_mcap) {
+  if (func < id_to_name_mcap && id_to_name_data[func] != NULL) {
+    fputs(id_to_name_data[func], out);
+  } else {
+    fputc('$', out);
+    readback_decimal(out, func); // TODO: function names
   }
+}
 
-  // Waits workers to stop
-  for (u64 tid = 1; tid < MAX_WORKERS; ++tid) {
-    pthread_join(workers[tid].thread, NULL);
-  }
+const char* readback_oper[16] = {
+  "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>", "<", "<=", "==", ">=", ">", "!=",
+};
 
-  #endif
+// Pending printer jobs, pushed as (value, kind) pairs
+#define READBACK_TERM (0) // prints the term `value`
+#define READBACK_CHAR (1) // prints the char `value`
+#define READBACK_OPER (2) // prints the operator `value`
+#define READBACK_PUSH (3) // pushes the direction `value & 1` on color `value >> 1`
+#define READBACK_POP  (4) // pops a direction of color `value`
 
-  // Clears workers
-  for (u64 tid = 0; tid < MAX_WORKERS; ++tid) {
-    for (u64 a = 0; a < MAX_ARITY; ++a) {
-      stk_free(&workers[tid].free[a]);
-    }
-    #ifdef PARALLEL
-    pthread_mutex_destroy(&workers[tid].has_work_mutex);
-    pthread_cond_destroy(&workers[tid].has_work_signal);
-    pthread_mutex_destroy(&workers[tid].has_result_mutex);
-    pthread_cond_destroy(&workers[tid].has_result_signal);
-    #endif
-  }
+void readback_job(Stk* jobs, u64 kind, u64 value) {
+  stk_push(jobs, value);
+  stk_push(jobs, kind);
 }
 
-// Readback
-// --------
-
-void readback_vars(Stk* vars, Worker* mem, Ptr term, Stk* seen) {
-  //printf("- readback_vars %llu ", get_loc(term,0)); debug_print_lnk(term); printf("\n");
-  if (stk_find(seen, term) != -1) { // FIXME: probably very slow, change to a proper hashmap
-    return;
-  } else {
-    stk_push(seen, term);
+void readback_term(FILE* out, Worker* mem, Ptr term, Map* vars, Dirs* dirs, char** id_to_name_data, u64 id_to_name_mcap) {
+  Stk jobs;
+  stk_init(&jobs);
+  readback_job(&jobs, READBACK_TERM, term);
+  while (jobs.size > 0) {
+    u64 kind = stk_pop(&jobs);
+    u64 value = stk_pop(&jobs);
+    switch (kind) {
+      case READBACK_CHAR: {
+        fputc((char)value, out);
+        continue;
+      }
+      case READBACK_OPER: {
+        fputs(readback_oper[value], out);
+        continue;
+      }
+      case READBACK_PUSH: {
+        stk_push(readback_dirs(dirs, value >> 1), value & 1);
+        continue;
+      }
+      case READBACK_POP: {
+        stk_pop(readback_dirs(dirs, value));
+        continue;
+      }
+    }
+    term = value;
     switch (get_tag(term)) {
       case LAM: {
-        u64 argm = ask_arg(mem, term, 0);
-        u64 body = ask_arg(mem, term, 1);
-        if (get_tag(argm) != ERA) {
-          stk_push(vars, Var(get_loc(term, 0)));
+        fputc('@', out);
+        if (get_tag(ask_arg(mem, term, 0)) == ERA) {
+          fputc('_', out);
+        } else {
+          fputc('x', out);
+          readback_decimal(out, map_get(vars, get_loc(term, 0)));
         };
-        readback_vars(vars, mem, body, seen);
+        fputc(' ', out);
+        readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, 1));
         break;
       }
       case APP: {
-        u64 lam = ask_arg(mem, term, 0);
-        u64 arg = ask_arg(mem, term, 1);
-        readback_vars(vars, mem, lam, seen);
-        readback_vars(vars, mem, arg, seen);
+        fputc('(', out);
+        readback_job(&jobs, READBACK_CHAR, ')');
+        readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, 1));
+        readback_job(&jobs, READBACK_CHAR, ' ');
+        readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, 0));
         break;
       }
       case SUP: {
-        u64 arg0 = ask_arg(mem, term, 0);
-        u64 arg1 = ask_arg(mem, term, 1);
-        readback_vars(vars, mem, arg0, seen);
-        readback_vars(vars, mem, arg1, seen);
+        u64  col = get_ext(term);
+        Stk* dir = readback_dirs(dirs, col);
+        if (dir->size > 0) {
+          u64 head = stk_pop(dir);
+          readback_job(&jobs, READBACK_PUSH, col << 1 | head);
+          readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, head == 0 ? 0 : 1));
+        } else {
+          fputc('<', out);
+          readback_job(&jobs, READBACK_CHAR, '>');
+          readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, 1));
+          readback_job(&jobs, READBACK_CHAR, ' ');
+          readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, 0));
+        }
         break;
       }
-      case DP0: {
-        u64 arg = ask_arg(mem, term, 2);
-        readback_vars(vars, mem, arg, seen);
+      case DP0: case DP1: {
+        u64 col = get_ext(term);
+        stk_push(readback_dirs(dirs, col), get_tag(term) == DP0 ? 0 : 1);
+        readback_job(&jobs, READBACK_POP, col);
+        readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, 2));
         break;
       }
-      case DP1: {
-        u64 arg = ask_arg(mem, term, 2);
-        readback_vars(vars, mem, arg, seen);
+      case OP2: {
+        fputc('(', out);
+        readback_job(&jobs, READBACK_CHAR, ')');
+        readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, 1));
+        readback_job(&jobs, READBACK_OPER, get_ext(term));
+        readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, 0));
         break;
       }
-      case OP2: {
-        u64 arg0 = ask_arg(mem, term, 0);
-        u64 arg1 = ask_arg(mem, term, 1);
-        readback_vars(vars, mem, arg0, seen);
-        readback_vars(vars, mem, arg1, seen);
+      case NUM: {
+        readback_decimal(out, get_num(term));
+        break;
+      }
+      case FLO: {
+        readback_flo(out, get_num(term));
         break;
       }
       case CTR: case FUN: {
-        u64 arity = ask_ari(mem, term);
-        for (u64 i = 0; i < arity; ++i) {
-          readback_vars(vars, mem, ask_arg(mem, term, i), seen);
+        u64 arit = ask_ari(mem, term);
+        fputc('(', out);
+        readback_name(out, get_fun(term), id_to_name_data, id_to_name_mcap);
+        readback_job(&jobs, READBACK_CHAR, ')');
+        for (u64 i = arit; i-- > 0;) {
+          readback_job(&jobs, READBACK_TERM, ask_arg(mem, term, i));
+          readback_job(&jobs, READBACK_CHAR, ' ');
         }
         break;
       }
+      case VAR: {
+        fputc('x', out);
+        readback_decimal(out, map_get(vars, get_loc(term, 0)));
+        break;
+      }
+      default: {
+        fputc('?', out);
+        break;
+      }
     }
   }
+  stk_free(&jobs);
 }
 
-void readback_decimal_go(Stk* chrs, u64 n) {
-  //printf("--- A %llu\n", n);
-  if (n > 0) {
-    readback_decimal_go(chrs, n / 10);
-    stk_push(chrs, '0' + (n % 10));
+void readback(FILE* out, Worker* mem, Ptr term, char** id_to_name_data, u64 id_to_name_mcap) {
+  Map  vars;
+  Dirs dirs;
+  map_init(&vars);
+  map_init(&dirs.cols);
+  dirs.data = NULL;
+  dirs.size = 0;
+  dirs.mcap = 0;
+
+  readback_vars(&vars, mem, term);
+  readback_term(out, mem, term, &vars, &dirs, id_to_name_data, id_to_name_mcap);
+
+  map_free(&vars);
+  map_free(&dirs.cols);
+  for (u64 i = 0; i < dirs.size; ++i) {
+    stk_free(&dirs.data[i]);
   }
+  free(dirs.data);
 }
 
-void readback_decimal(Stk* chrs, u64 n) {
-  if (n == 0) {
-    stk_push(chrs, '0');
-  } else {
-    readback_decimal_go(chrs, n);
-  }
-}
-
-void readback_term(Stk* chrs, Worker* mem, Ptr term, Stk* vars, Stk* dirs, char** id_to_name_data, u64 id_to_name_mcap) {
-  //printf("- readback_term: "); debug_print_lnk(term); printf("\n");
-  switch (get_tag(term)) {
-    case LAM: {
-      stk_push(chrs, '@');
-      if (get_tag(ask_arg(mem, term, 0)) == ERA) {
-        stk_push(chrs, '_');
-      } else {
-        stk_push(chrs, 'x');
-        readback_decimal(chrs, stk_find(vars, Var(get_loc(term, 0))));
-      };
-      stk_push(chrs, ' ');
-      readback_term(chrs, mem, ask_arg(mem, term, 1), vars, dirs, id_to_name_data, id_to_name_mcap);
-      break;
-    }
-    case APP: {
-      stk_push(chrs, '(');
-      readback_term(chrs, mem, ask_arg(mem, term, 0), vars, dirs, id_to_name_data, id_to_name_mcap);
-      stk_push(chrs, ' ');
-      readback_term(chrs, mem, ask_arg(mem, term, 1), vars, dirs, id_to_name_data, id_to_name_mcap);
-      stk_push(chrs, ')');
-      break;
-    }
-    case SUP: {
-      u64 col = get_ext(term);
-      if (dirs[col].size > 0) {
-        u64 head = stk_pop(&dirs[col]);
-        if (head == 0) {
-          readback_term(chrs, mem, ask_arg(mem, term, 0), vars, dirs, id_to_name_data, id_to_name_mcap);
-          stk_push(&dirs[col], head);
-        } else {
-          readback_term(chrs, mem, ask_arg(mem, term, 1), vars, dirs, id_to_name_data, id_to_name_mcap);
-          stk_push(&dirs[col], head);
+// Streaming
+// ---------
+// Prints the normal form of a term while it's being computed, head first, so
+// big or infinite results, like lazy lists, show up as soon as each part is
+// ready. Constructors are reduced to weak head normal form and printed, then
+// their fields, left to right. The last field reuses the slot of its parent,
+// whose node is freed right away, so walking down a list takes no memory, and
+// the closing parens of the spine are just counted. Terms other than data are
+// normalized and read back in one go. With a limit, printing stops after that
+// many constructors on the spine (the chain of last fields from the root).
+
+struct Stream {
+  FILE*  out;
+  u64    limit; // spine constructors to print, or -1
+  char** id_to_name_data;
+  u64    id_to_name_size;
+};
+
+#define STREAM_TERM  (0) // prints the term on location `value`
+#define STREAM_CHAR  (1) // prints the char `value`
+#define STREAM_CLOSE (2) // prints `value` closing parens
+#define STREAM_TAIL  (3) // prints the last field of the node on location `value`
+#define STREAM_SPINE (4) // flag for terms and tails on the spine
+
+void stream_normal(Worker* mem, u64 host, u64 slen, Stream* stream) {
+  FILE* out  = stream->out;
+  u64   seen = 0;
+  Stk   jobs;
+  struct timeval last, now;
+  gettimeofday(&last, NULL);
+  stk_init(&jobs);
+  readback_job(&jobs, STREAM_TERM | STREAM_SPINE, host);
+  while (jobs.size > 0) {
+    u64 kind  = stk_pop(&jobs);
+    u64 value = stk_pop(&jobs);
+    u64 spine = kind & STREAM_SPINE;
+    switch (kind & ~STREAM_SPINE) {
+      case STREAM_CHAR: {
+        fputc((char)value, out);
+        continue;
+      }
+      case STREAM_CLOSE: {
+        for (u64 i = 0; i < value; ++i) {
+          fputc(')', out);
         }
-      } else {
-        stk_push(chrs, '<');
-        readback_term(chrs, mem, ask_arg(mem, term, 0), vars, dirs, id_to_name_data, id_to_name_mcap);
-        stk_push(chrs, ' ');
-        readback_term(chrs, mem, ask_arg(mem, term, 1), vars, dirs, id_to_name_data, id_to_name_mcap);
-        stk_push(chrs, '>');
+        continue;
+      }
+      case STREAM_TAIL: {
+        Ptr term = ask_lnk(mem, value);
+        u64 arit = ask_ari(mem, term);
+        link(mem, value, ask_arg(mem, term, arit - 1));
+        clear(mem, get_loc(term, 0), arit);
+        break;
       }
-      break;
-    }
-    case DP0: case DP1: {
-      u64 col = get_ext(term);
-      u64 val = ask_arg(mem, term, 2);
-      stk_push(&dirs[col], get_tag(term) == DP0 ? 0 : 1);
-      readback_term(chrs, mem, ask_arg(mem, term, 2), vars, dirs, id_to_name_data, id_to_name_mcap);
-      stk_pop(&dirs[col]);
-      break;
-    }
-    case OP2: {
-      stk_push(chrs, '(');
-      readback_term(chrs, mem, ask_arg(mem, term, 0), vars, dirs, id_to_name_data, id_to_name_mcap);
-      switch (get_ext(term)) {
-        case ADD: { stk_push(chrs, '+'); break; }
-        case SUB: { stk_push(chrs, '-'); break; }
-        case MUL: { stk_push(chrs, '*'); break; }
-        case DIV: { stk_push(chrs, '/'); break; }
-        case MOD: { stk_push(chrs, '%'); break; }
-        case AND: { stk_push(chrs, '&'); break; }
-        case OR: { stk_push(chrs, '|'); break; }
-        case XOR: { stk_push(chrs, '^'); break; }
-        case SHL: { stk_push(chrs, '<'); stk_push(chrs, '<'); break; }
-        case SHR: { stk_push(chrs, '>'); stk_push(chrs, '>'); break; }
-        case LTN: { stk_push(chrs, '<'); break; }
-        case LTE: { stk_push(chrs, '<'); stk_push(chrs, '='); break; }
-        case EQL: { stk_push(chrs, '='); stk_push(chrs, '='); break; }
-        case GTE: { stk_push(chrs, '>'); stk_push(chrs, '='); break; }
-        case GTN: { stk_push(chrs, '>'); break; }
-        case NEQ: { stk_push(chrs, '!'); stk_push(chrs, '='); break; }
-      }
-      readback_term(chrs, mem, ask_arg(mem, term, 1), vars, dirs, id_to_name_data, id_to_name_mcap);
-      stk_push(chrs, ')');
-      break;
-    }
-    case NUM: {
-      //printf("- u32\n");
-      readback_decimal(chrs, get_num(term));
-      //printf("- u32 done\n");
-      break;
     }
-    case CTR: case FUN: {
-      u64 func = get_ext(term);
-      u64 arit = ask_ari(mem, term);
-      stk_push(chrs, '(');
-      if (func < id_to_name_mcap && id_to_name_data[func] != NULL) {
-        for (u64 i = 0; id_to_name_data[func][i] != '\0'; ++i) {
-          stk_push(chrs, id_to_name_data[func][i]);
+    // Prints the term on location `value`
+    u64 loc  = value;
+    Ptr term = reduce(mem, loc, slen);
+    switch (get_tag(term)) {
+      case NUM: {
+        readback_decimal(out, get_num(term));
+        break;
+      }
+      case FLO: {
+        readback_flo(out, get_num(term));
+        break;
+      }
+      case CTR: case FUN: {
+        u64 arit = ask_ari(mem, term);
+        if (spine && arit > 0 && seen >= stream->limit) {
+          fputs("...", out);
+          break;
         }
-      } else {
-        stk_push(chrs, '$');
-        readback_decimal(chrs, func); // TODO: function names
+        fputc('(', out);
+        readback_name(out, get_fun(term), stream->id_to_name_data, stream->id_to_name_size);
+        if (arit == 0) {
+          fputc(')', out);
+          break;
+        }
+        if (jobs.size > 0 && jobs.data[jobs.size - 1] == STREAM_CLOSE) {
+          jobs.data[jobs.size - 2] += 1;
+        } else {
+          readback_job(&jobs, STREAM_CLOSE, 1);
+        }
+        readback_job(&jobs, STREAM_TAIL | spine, loc);
+        readback_job(&jobs, STREAM_CHAR, ' ');
+        for (u64 i = arit - 1; i-- > 0;) {
+          readback_job(&jobs, STREAM_TERM, get_loc(term, i));
+          readback_job(&jobs, STREAM_CHAR, ' ');
+        }
+        if (spine) {
+          seen += 1;
+          // Flushes at most every 10ms, so the output shows up promptly
+          gettimeofday(&now, NULL);
+          if ((now.tv_sec - last.tv_sec) * 1000000 + now.tv_usec - last.tv_usec > 10000) {
+            fflush(out);
+            last = now;
+          }
+        }
+        break;
       }
-      for (u64 i = 0; i < arit; ++i) {
-        stk_push(chrs, ' ');
-        readback_term(chrs, mem, ask_arg(mem, term, i), vars, dirs, id_to_name_data, id_to_name_mcap);
+      default: {
+        term = normal(mem, loc, slen);
+        readback(out, mem, term, stream->id_to_name_data, stream->id_to_name_size);
+        collect(mem, term);
+        break;
       }
-      stk_push(chrs, ')');
-      break;
     }
-    case VAR: {
-      stk_push(chrs, 'x');
-      readback_decimal(chrs, stk_find(vars, term));
-      break;
-    }
-    default: {
-      stk_push(chrs, '?');
-      break;
-    }
-  }
-}
-
-void readback(char* code_data, u64 code_mcap, Worker* mem, Ptr term, char** id_to_name_data, u64 id_to_name_mcap) {
-  //printf("reading back\n");
-
-  // Used vars
-  Stk seen;
-  Stk chrs;
-  Stk vars;
-  Stk* dirs;
-
-  // Initialization
-  stk_init(&seen);
-  stk_init(&chrs);
-  stk_init(&vars);
-  dirs = (Stk*)malloc(sizeof(Stk) * DIRS_MCAP);
-  assert(dirs);
-  for (u64 i = 0; i < DIRS_MCAP; ++i) {
-    stk_init(&dirs[i]);
-  }
-
-  // Readback
-  readback_vars(&vars, mem, term, &seen);
-  readback_term(&chrs, mem, term, &vars, dirs, id_to_name_data, id_to_name_mcap);
-
-  // Generates C string
-  for (u64 i = 0; i < chrs.size && i < code_mcap; ++i) {
-    code_data[i] = chrs.data[i];
-  }
-  code_data[chrs.size < code_mcap ? chrs.size : code_mcap] = '\0';
-
-  // Cleanup
-  stk_free(&seen);
-  stk_free(&chrs);
-  stk_free(&vars);
-  for (u64 i = 0; i < DIRS_MCAP; ++i) {
-    stk_free(&dirs[i]);
   }
+  stk_free(&jobs);
+  fflush(out);
 }
 
 // Debug
@@ -1387,14 +3204,267 @@ void debug_print_lnk(Ptr x) {
   printf(":%"PRIx64":%"PRIx64"", ext, val);
 }
 
+// Parsing
+// -------
+// Reads the terms given to a compiled program: numbers, floats, 'c' chars,
+// "strings", [lists], constructors and function calls, like `(Foo 1 Bar)`.
+// Nodes are written straight into the heap, after `mem->size`. The parser keeps
+// the pending arguments on a stack, so long inputs can't overflow the C stack.
+
+typedef struct {
+  char*  code;
+  Map    names; // name hash -> id
+  char** id_to_name_data;
+  u64    id_to_name_size;
+  u64*   id_to_arity_data;
+  u8*    id_to_is_fun_data;
+} Parser;
+
+u64 parse_hash(char* name, u64 size) {
+  u64 hash = 0xCBF29CE484222325; // FNV-1a
+  for (u64 i = 0; i < size; ++i) {
+    hash = (hash ^ (u8)name[i]) * 0x100000001B3;
+  }
+  return hash;
+}
+
+void parse_init(Parser* parser, char** id_to_name_data, u64 id_to_name_size, u64* id_to_arity_data, u8* id_to_is_fun_data) {
+  parser->code = NULL;
+  parser->id_to_name_data = id_to_name_data;
+  parser->id_to_name_size = id_to_name_size;
+  parser->id_to_arity_data = id_to_arity_data;
+  parser->id_to_is_fun_data = id_to_is_fun_data;
+  map_init(&parser->names);
+  for (u64 id = 0; id < id_to_name_size; ++id) {
+    char* name = id_to_name_data[id];
+    map_set(&parser->names, parse_hash(name, strlen(name)), id);
+  }
+}
+
+void parse_free(Parser* parser) {
+  map_free(&parser->names);
+}
+
+void parse_error(Parser* parser, const char* expected) {
+  fprintf(stderr, "Parse error: expected %s, found '%.24s'.\n", expected, parser->code);
+  exit(1);
+}
+
+u8 parse_is_name_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '$';
+}
+
+// Skips whitespace and `//` comments. Commas are skipped too, so they can
+// separate the elements of lists.
+void parse_skip(Parser* parser) {
+  while (1) {
+    char c = *parser->code;
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',') {
+      parser->code += 1;
+    } else if (c == '/' && parser->code[1] == '/') {
+      while (*parser->code != '\0' && *parser->code != '\n') {
+        parser->code += 1;
+      }
+    } else {
+      return;
+    }
+  }
+}
+
+// Reads the id of a constructor or function name
+u64 parse_name(Parser* parser) {
+  char* name = parser->code;
+  u64   size = 0;
+  while (parse_is_name_char(name[size])) {
+    size += 1;
+  }
+  u64 id = map_get(&parser->names, parse_hash(name, size));
+  if (id == -1 || strncmp(parser->id_to_name_data[id], name, size) != 0 || parser->id_to_name_data[id][size] != '\0') {
+    parse_error(parser, "a name used by the program");
+  }
+  parser->code += size;
+  return id;
+}
+
+// Decodes one UTF-8 character
+u64 parse_char(Parser* parser) {
+  u8* code = (u8*)parser->code;
+  u64 size = code[0] < 0x80 ? 1 : code[0] < 0xE0 ? 2 : code[0] < 0xF0 ? 3 : 4;
+  u64 chr  = size == 1 ? code[0] : code[0] & (0x7F >> size);
+  for (u64 i = 1; i < size; ++i) {
+    if ((code[i] & 0xC0) != 0x80) {
+      parse_error(parser, "a UTF-8 character");
+    }
+    chr = (chr << 6) | (code[i] & 0x3F);
+  }
+  parser->code += size;
+  return chr;
+}
+
+// Builds `(name args...)` with the `ari` topmost terms on `args`
+Ptr parse_make(Parser* parser, Worker* mem, Stk* args, u64 id, u64 ari) {
+  if (parser->id_to_is_fun_data[id] && parser->id_to_arity_data[id] != ari) {
+    parse_error(parser, "a call with the function's arity");
+  }
+  if (mem->size + ari > heap_words) {
+    fprintf(stderr, "Out of memory: input doesn't fit the heap.\n");
+    exit(1);
+  }
+  u64 loc = ari > 0 ? mem->size : 0;
+  args->size -= ari;
+  for (u64 i = 0; i < ari; ++i) {
+    mem->node[loc + i] = args->data[args->size + i];
+  }
+  mem->size += ari;
+  return parser->id_to_is_fun_data[id] ? Cal(ari, id, loc) : Ctr(ari, id, loc);
+}
+
+// Finds the id of a name the parser's sugars build, or -1, if it isn't used
+u64 parse_sugar_id(Parser* parser, char* name) {
+  u64 id = map_get(&parser->names, parse_hash(name, strlen(name)));
+  return id != -1 && strcmp(parser->id_to_name_data[id], name) == 0 ? id : -1;
+}
+
+// Builds a list, or a string, with the `len` topmost terms on `args`
+Ptr parse_list(Parser* parser, Worker* mem, Stk* args, u64 len, char* nil_name, char* cons_name) {
+  u64 nil  = parse_sugar_id(parser, nil_name);
+  u64 cons = parse_sugar_id(parser, cons_name);
+  if (nil == -1 || cons == -1) {
+    parse_error(parser, len > 0 ? cons_name : nil_name);
+  }
+  Ptr list = parse_make(parser, mem, args, nil, 0);
+  for (u64 i = 0; i < len; ++i) {
+    stk_push(args, list);
+    list = parse_make(parser, mem, args, cons, 2);
+  }
+  return list;
+}
+
+Ptr parse_number(Parser* parser) {
+  char* numb = parser->code;
+  char* done = numb;
+  u8    real = 0;
+  while (parse_is_name_char(*done)) {
+    real = real || *done == '.';
+    done += 1;
+  }
+  char* end;
+  Ptr term = real ? Flo(flo_val(strtod(numb, &end))) : Num(strtoull(numb, &end, 10));
+  if (end != done) {
+    parse_error(parser, "a number");
+  }
+  parser->code = done;
+  return term;
+}
+
+// Parses one term. Finished terms wait for their parents on `args`, while
+// `open` has a (start, id, delimiter) triple for each unclosed paren or bracket.
+Ptr parse_term(Parser* parser, Worker* mem) {
+  Stk args;
+  Stk open;
+  stk_init(&args);
+  stk_init(&open);
+  do {
+    parse_skip(parser);
+    char c = *parser->code;
+    char top = open.size > 0 ? open.data[open.size - 1] : 0;
+    if (c == '(') {
+      parser->code += 1;
+      parse_skip(parser);
+      if (!(*parser->code >= 'A' && *parser->code <= 'Z')) {
+        parse_error(parser, "a constructor or function name");
+      }
+      stk_push(&open, args.size);
+      stk_push(&open, parse_name(parser));
+      stk_push(&open, '(');
+    } else if (c == '[') {
+      parser->code += 1;
+      stk_push(&open, args.size);
+      stk_push(&open, 0);
+      stk_push(&open, '[');
+    } else if ((c == ')' && top == '(') || (c == ']' && top == '[')) {
+      parser->code += 1;
+      stk_pop(&open);
+      u64 id    = stk_pop(&open);
+      u64 start = stk_pop(&open);
+      Ptr term  = c == ')'
+        ? parse_make(parser, mem, &args, id, args.size - start)
+        : parse_list(parser, mem, &args, args.size - start, "List.nil", "List.cons");
+      stk_push(&args, term);
+    } else if (c >= '0' && c <= '9') {
+      stk_push(&args, parse_number(parser));
+    } else if (c == '\'') {
+      parser->code += 1;
+      if (*parser->code == '\0') {
+        parse_error(parser, "a character");
+      }
+      stk_push(&args, Num(parse_char(parser)));
+      if (*parser->code != '\'') {
+        parse_error(parser, "a closing quote");
+      }
+      parser->code += 1;
+    } else if (c == '"' || c == '`') {
+      parser->code += 1;
+      u64 len = 0;
+      while (*parser->code != c) {
+        if (*parser->code == '\0') {
+          parse_error(parser, "a closing quote");
+        }
+        stk_push(&args, Num(parse_char(parser)));
+        len += 1;
+      }
+      parser->code += 1;
+      stk_push(&args, parse_list(parser, mem, &args, len, "String.nil", "String.cons"));
+    } else if (c >= 'A' && c <= 'Z') {
+      stk_push(&args, parse_make(parser, mem, &args, parse_name(parser), 0));
+    } else {
+      parse_error(parser, "a term");
+    }
+  } while (open.size > 0);
+  Ptr term = stk_pop(&args);
+  stk_free(&args);
+  stk_free(&open);
+  return term;
+}
+
+// Reads a whole file, or stdin, if `path` is "-"
+char* parse_read_file(char* path) {
+  FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  u64   size = 0;
+  u64   mcap = 0x10000;
+  char* data = (char*)malloc(mcap);
+  assert(data);
+  while (1) {
+    size += fread(data + size, 1, mcap - size - 1, file);
+    if (size < mcap - 1) {
+      break;
+    }
+    mcap *= 2;
+    data = (char*)realloc(data, mcap);
+    assert(data);
+  }
+  data[size] = '\0';
+  if (file != stdin) {
+    fclose(file);
+  }
+  return data;
+}
+
 // Main
 // ----
 
-Ptr parse_arg(char* code, char** id_to_name_data, u64 id_to_name_size) {
-  if (code[0] >= '0' && code[0] <= '9') {
-    return Num(strtol(code, 0, 10));
-  } else {
-    return Num(0);
+// Parses a memory size, in bytes, with an optional K, M or G suffix
+u64 parse_size(char* code) {
+  char* end;
+  u64 size = strtoull(code, &end, 10);
+  switch (*end) {
+    case 'k': case 'K': return size << 10;
+    case 'm': case 'M': return size << 20;
+    case 'g': case 'G': return size << 30;
+    default: return size;
   }
 }
 
@@ -1404,6 +3474,78 @@ int main(int argc, char* argv[]) {
   Worker mem;
   struct timeval stop, start;
 
+  // Runtime options: `-M <size>` sets the heap size, `-T <num>` sets the number
+  // of workers, `-H` uses transparent huge pages and `-C <num>` compacts the
+  // heap every `num` rewrites. `-S <file>` saves the normalized heap to an
+  // image, and `-L <file>` starts from an image instead of Main, applying its
+  // term to the remaining args. Otherwise, they go to Main. Args are HVM terms,
+  // and `-I <file>` reads more of them from a file, or from stdin, with `-`.
+  // `-O` prints the normal form as it's computed, and `-N <num>` stops that
+  // after `num` elements.
+  u64   heap_size = DEFAULT_HEAP_SIZE;
+  u8    heap_huge = 0;
+  char* save_path = NULL;
+  char* load_path = NULL;
+  char* input_path = NULL;
+  u8    stream_on = 0;
+  u64   stream_limit = -1;
+  num_workers = DEFAULT_WORKERS;
+  int argi = 1;
+  while (argi < argc && argv[argi][0] == '-') {
+    if (strcmp(argv[argi], "--") == 0) {
+      argi += 1;
+      break;
+    } else if (strcmp(argv[argi], "-M") == 0 && argi + 1 < argc) {
+      heap_size = parse_size(argv[argi + 1]);
+      argi += 2;
+    } else if (strcmp(argv[argi], "-T") == 0 && argi + 1 < argc) {
+      num_workers = strtoull(argv[argi + 1], 0, 10);
+      argi += 2;
+    } else if (strcmp(argv[argi], "-C") == 0 && argi + 1 < argc) {
+      compact_rate = strtoull(argv[argi + 1], 0, 10);
+      argi += 2;
+    } else if (strcmp(argv[argi], "-H") == 0) {
+      heap_huge = 1;
+      argi += 1;
+    } else if (strcmp(argv[argi], "-S") == 0 && argi + 1 < argc) {
+      save_path = argv[argi + 1];
+      argi += 2;
+    } else if (strcmp(argv[argi], "-L") == 0 && argi + 1 < argc) {
+      load_path = argv[argi + 1];
+      argi += 2;
+    } else if (strcmp(argv[argi], "-I") == 0 && argi + 1 < argc) {
+      input_path = argv[argi + 1];
+      argi += 2;
+    } else if (strcmp(argv[argi], "-O") == 0) {
+      stream_on = 1;
+      argi += 1;
+    } else if (strcmp(argv[argi], "-N") == 0 && argi + 1 < argc) {
+      stream_on = 1;
+      stream_limit = strtoull(argv[argi + 1], 0, 10);
+      argi += 2;
+    #ifdef TRACE
+    } else if (strcmp(argv[argi], "-P") == 0 && argi + 1 < argc) {
+      trace_path = argv[argi + 1];
+      argi += 2;
+    #endif
+    } else {
+      fprintf(stderr, "Usage: %s [-M <heap size>] [-T <workers>] [-H] [-C <rewrites>] [-S <image>] [-L <image>] [-I <input>] [-O] [-N <elements>] [--] [args...]\n", argv[0]);
+      return 1;
+    }
+  }
+  #ifndef PARALLEL
+  num_workers = 1;
+  #endif
+  if (num_workers < 1) {
+    num_workers = 1;
+  }
+  heap_words = heap_size / sizeof(u64);
+  if (heap_words > VAL_MASK + 1) {
+    heap_words = VAL_MASK + 1;
+  }
+  workers = (Worker*)calloc(num_workers, sizeof(Worker));
+  assert(workers);
+
   // Id-to-Name map
   const u64 id_to_name_size = /*! GENERATED_NAME_COUNT */ 1 /* GENERATED_NAME_COUNT !*/;
   char* id_to_name_data[id_to_name_size];
@@ -1414,30 +3556,96 @@ int main(int argc, char* argv[]) {
   u64 id_to_arity_data[id_to_arity_size];
 /*! GENERATED_ID_TO_ARITY_DATA !*/
 
+  // Id-to-Is-Function map
+  u8 id_to_is_fun_data[id_to_name_size];
+  memset(id_to_is_fun_data, 0, sizeof(id_to_is_fun_data));
+/*! GENERATED_ID_TO_IS_FUN_DATA !*/
+
   // Builds main term
+  u64 hash = image_hash(id_to_name_data, id_to_name_size);
+  u64 host = 0;
   mem.size = 0;
-  mem.node = (u64*)malloc(HEAP_SIZE);
-  mem.aris = id_to_arity_data;
-  mem.funs = id_to_arity_size;
+  mem.node = (u64*)mem_reserve(heap_words * sizeof(u64), heap_huge);
   assert(mem.node);
-  if (argc <= 1) {
-    mem.node[mem.size++] = Cal(0, _MAIN_, 0);
+  if (load_path) {
+    heap_image = image_load(load_path, mem.node, hash);
+    if (!heap_image) {
+      fprintf(stderr, "Can't load heap image '%s'.\n", load_path);
+      return 1;
+    }
+    mem.size = heap_image->used;
+  }
+  host = mem.size++;
+
+  // Parses the args, then the terms on the input file
+  Parser parser;
+  Stk    args;
+  parse_init(&parser, id_to_name_data, id_to_name_size, id_to_arity_data, id_to_is_fun_data);
+  stk_init(&args);
+  for (int i = argi; i < argc; ++i) {
+    parser.code = argv[i];
+    stk_push(&args, parse_term(&parser, &mem));
+    parse_skip(&parser);
+    if (*parser.code != '\0') {
+      parse_error(&parser, "the end of the argument");
+    }
+  }
+  if (input_path) {
+    char* input = parse_read_file(input_path);
+    if (!input) {
+      fprintf(stderr, "Can't read input '%s'.\n", input_path);
+      return 1;
+    }
+    parser.code = input;
+    parse_skip(&parser);
+    while (*parser.code != '\0') {
+      stk_push(&args, parse_term(&parser, &mem));
+      parse_skip(&parser);
+    }
+    free(input);
+  }
+  parse_free(&parser);
+
+  if (heap_image) {
+    // Applies the image's term to the args, one App node each
+    mem.node[host] = mem.node[heap_image->root];
+    for (u64 i = 0; i < args.size; ++i) {
+      u64 app = mem.size;
+      mem.size += 2;
+      link(&mem, app + 0, mem.node[host]);
+      link(&mem, app + 1, args.data[i]);
+      mem.node[host] = App(app);
+    }
+    link(&mem, host, mem.node[host]);
   } else {
-    mem.node[mem.size++] = Cal(argc - 1, _MAIN_, 1);
-    for (u64 i = 1; i < argc; ++i) {
-      mem.node[mem.size++] = parse_arg(argv[i], id_to_name_data, id_to_name_size);
+    u64 loc = args.size > 0 ? mem.size : 0;
+    for (u64 i = 0; i < args.size; ++i) {
+      mem.node[mem.size++] = args.data[i];
     }
+    mem.node[host] = Cal(args.size, _MAIN_, loc);
   }
-
-  for (u64 tid = 0; tid < MAX_WORKERS; ++tid) {
-    workers[tid].aris = id_to_arity_data;
-    workers[tid].funs = id_to_arity_size;
+  stk_free(&args);
+
+  // Streams the result, if asked to. Printed parts are freed, so there is no
+  // heap to save, and no compaction, which would move the pending parts.
+  Stream stream = {stdout, stream_limit, id_to_name_data, id_to_name_size};
+  if (stream_on) {
+    if (save_path) {
+      fprintf(stderr, "Can't save a heap image of a streamed result.\n");
+      return 1;
+    }
+    stream_to = &stream;
+    compact_rate = 0;
   }
 
+  #ifdef PROFILE
+  prof_size = PROF_KINDS + id_to_name_size * PROF_RULES;
+  #endif
+
   // Reduces and benchmarks
   //printf("Reducing.\n");
   gettimeofday(&start, NULL);
-  ffi_normal((u8*)mem.node, mem.size, 0);
+  ffi_normal((u8*)mem.node, mem.size, host);
   gettimeofday(&stop, NULL);
 
   // Prints result statistics
@@ -1445,18 +3653,28 @@ int main(int argc, char* argv[]) {
   double rwt_per_sec = (double)ffi_cost / (double)delta_time;
 
   // Prints result normal form
-  const u64 code_mcap = 256 * 256 * 256; // max code size = 16 MB
-  char* code_data = (char*)malloc(code_mcap * sizeof(char));
-  assert(code_data);
-  readback(code_data, code_mcap, &mem, mem.node[0], id_to_name_data, id_to_name_size);
-  printf("%s\n", code_data);
+  if (!stream_on) {
+    readback(stdout, &mem, mem.node[host], id_to_name_data, id_to_name_size);
+  }
+  printf("\n");
+
+  // Saves the heap image
+  if (save_path && !image_save(save_path, &mem, host, hash)) {
+    fprintf(stderr, "Can't save heap image '%s'.\n", save_path);
+    return 1;
+  }
 
   // Prints statistics
   fprintf(stderr, "\n");
   fprintf(stderr, "Rewrites: %"PRIu64" (%.2f MR/s).\n", ffi_cost, rwt_per_sec);
   fprintf(stderr, "Mem.Size: %"PRIu64" words.\n", ffi_size);
+  #ifdef PROFILE
+  prof_report(stderr, id_to_name_data, id_to_name_size);
+  free(prof_total);
+  #endif
 
   // Cleanup
-  free(code_data);
-  free(mem.node);
+  free(heap_image);
+  mem_release(mem.node, heap_words * sizeof(u64));
+  free(workers);
 }
@@ -15,7 +15,7 @@
 //   A : u30 is the 1st value
 //   B : u30 is the 2nd value
 //
-// There are 12 possible tags:
+// There are 13 possible tags:
 //
 //   Tag | Val | Meaning  
 //   ----| --- | -------------------------------
@@ -31,6 +31,7 @@
 //   FUN |   9 | a function
 //   OP2 |  10 | a numeric operation
 //   NUM |  11 | a 60-bit number
+//   FLO |  12 | a 60-bit float
 //
 // The semantics of the 1st and 2nd values depend on the pointer tag. 
 //
@@ -48,12 +49,14 @@
 //   FUN | the function name            | points to the function node
 //   OP2 | the operation name           | points to the operation node
 //   NUM | the most significant 30 bits | the least significant 30 bits
+//   FLO | the most significant 30 bits | the least significant 30 bits
 //
 // Notes:
 //
 //   1. The duplication label is an internal value used on the DUP-SUP rule.
 //   2. The operation name only uses 4 of the 30 bits, as there are only 16 ops.
 //   3. NUM pointers don't point anywhere, they just store the number directly.
+//   4. FLO pointers store a double without the 4 least significant bits of its mantissa.
 //
 // A node is a tuple of N pointers stored on sequential memory indices.
 // The meaning of each index depends on the node. There are 7 types:
@@ -171,7 +174,9 @@
 #![allow(dead_code)]
 #![allow(non_snake_case)]
 
-use std::collections::{hash_map, HashMap};
+use std::cell::Cell;
+use std::collections::{hash_map, HashMap, HashSet};
+use std::sync::mpsc;
 
 // Constants
 // ---------
@@ -186,11 +191,18 @@ pub const MAX_DYNFUNS: u64 = 65536;
 
 pub const SEEN_SIZE: usize = 4194304; // uses 32 MB, covers heaps up to 2 GB
 
+// A Ptr has a 4-bit tag, a 24-bit ext and a 36-bit val. On CTR and FUN, the
+// ext holds a 16-bit function id, with the arity on its top 8 bits.
 pub const VAL: u64 = 1;
-pub const EXT: u64 = 0x100000000;
-pub const ARI: u64 = 0x100000000000000;
-pub const TAG: u64 = 0x1000000000000000;
+pub const EXT: u64 = 0x10_0000_0000;
+pub const ARI: u64 = 0x10_0000_0000_0000;
+pub const TAG: u64 = 0x1000_0000_0000_0000;
 
+// The largest function id and arity a CTR or FUN link can hold
+pub const MAX_FUN_ID: u64 = 0xFFFF;
+pub const MAX_FUN_ARI: u64 = 0xFF;
+
+pub const VAL_MASK: u64 = 0xF_FFFF_FFFF;
 pub const NUM_MASK: u64 = 0xFFF_FFFF_FFFF_FFFF;
 
 pub const DP0: u64 = 0x0;
@@ -205,6 +217,7 @@ pub const CTR: u64 = 0x8;
 pub const FUN: u64 = 0x9;
 pub const OP2: u64 = 0xA;
 pub const NUM: u64 = 0xB;
+pub const FLO: u64 = 0xC;
 
 pub const ADD: u64 = 0x0;
 pub const SUB: u64 = 0x1;
@@ -260,12 +273,19 @@ pub const HOAS_NUM : u64 = 27;
 
 pub type Ptr = u64;
 
-pub type Rewriter = Box<dyn Fn(&mut Worker, &Funs, &mut u64, u64, Ptr) -> bool>;
+pub type Native = Box<dyn Fn(&mut Worker, &Funs, &mut u64, u64, Ptr) -> bool>;
+
+// User functions are compiled to bytecode (see 'Bytecode'); builtins, like HVM.log, are closures.
+pub enum Rewriter {
+  Bytecode(Vec<u64>),
+  Native(Native),
+}
 
 pub struct Function {
   pub arity: u64,
   pub stricts: Vec<u64>,
   pub rewriter: Rewriter,
+  pub jitted: Cell<Option<Jitted>>, // a native build of its bytecode, installed mid-run (see 'Tiers')
 }
 
 pub struct Arity(pub u64);
@@ -280,6 +300,9 @@ pub struct Worker {
   pub free: Vec<Vec<u64>>,
   pub dups: u64,
   pub cost: u64,
+  pub dead: Vec<Ptr>, // pending subterms of collect(), reused across calls
+  pub regs: Vec<u64>, // registers of the bytecode VM, reused across calls
+  pub tiers: Option<Tiers>, // if set, hot functions are compiled to native code (see 'Tiers')
 }
 
 pub fn new_worker(size: usize) -> Worker {
@@ -290,6 +313,9 @@ pub fn new_worker(size: usize) -> Worker {
     free: vec![vec![]; 256],
     dups: 0,
     cost: 0,
+    dead: vec![],
+    regs: vec![],
+    tiers: None,
   }
 }
 
@@ -342,13 +368,22 @@ pub fn Num(val: u64) -> Ptr {
   (NUM * TAG) | (val & NUM_MASK)
 }
 
-pub fn Ctr(_ari: u64, fun: u64, pos: u64) -> Ptr {
-  (CTR * TAG) | (fun * EXT) | pos
+pub fn Flo(val: u64) -> Ptr {
+  (FLO * TAG) | (val & NUM_MASK)
+}
+
+// The 60-bit representation of a double
+pub fn flo_val(x: f64) -> u64 {
+  x.to_bits() >> 4
+}
+
+pub fn Ctr(ari: u64, fun: u64, pos: u64) -> Ptr {
+  (CTR * TAG) | (ari * ARI) | (fun * EXT) | pos
 }
 
 // FIXME: update name to Fun
-pub fn Cal(_ari: u64, fun: u64, pos: u64) -> Ptr {
-  (FUN * TAG) | (fun * EXT) | pos
+pub fn Cal(ari: u64, fun: u64, pos: u64) -> Ptr {
+  (FUN * TAG) | (ari * ARI) | (fun * EXT) | pos
 }
 
 // Getters
@@ -363,13 +398,39 @@ pub fn get_ext(lnk: Ptr) -> u64 {
 }
 
 pub fn get_val(lnk: Ptr) -> u64 {
-  lnk & 0xFFFF_FFFF
+  lnk & VAL_MASK
+}
+
+// The function id of a CTR or FUN link
+pub fn get_fun(lnk: Ptr) -> u64 {
+  (lnk / EXT) & 0xFFFF
+}
+
+// The arity of a CTR or FUN link
+pub fn get_ari(lnk: Ptr) -> u64 {
+  (lnk / ARI) & 0xFF
 }
 
 pub fn get_num(lnk: Ptr) -> u64 {
   lnk & 0xFFF_FFFF_FFFF_FFFF
 }
 
+pub fn get_flo(lnk: Ptr) -> f64 {
+  f64::from_bits(get_num(lnk) << 4)
+}
+
+// A NUM or FLO link as a double
+pub fn get_real(lnk: Ptr) -> f64 {
+  if get_tag(lnk) == FLO { get_flo(lnk) } else { get_num(lnk) as f64 }
+}
+
+// Remainder of a truncated division, computed as the C runtime does
+pub fn flo_mod(a: f64, b: f64) -> f64 {
+  let q = a / b;
+  let q = if q > -4503599627370496.0 && q < 4503599627370496.0 { q as i64 as f64 } else { q };
+  a - b * q
+}
+
 pub fn get_loc(lnk: Ptr, arg: u64) -> u64 {
   get_val(lnk) + arg
 }
@@ -377,16 +438,8 @@ pub fn get_loc(lnk: Ptr, arg: u64) -> u64 {
 // Memory
 // ------
 
-pub fn ask_ari(mem: &Worker, lnk: Ptr) -> u64 {
-  let got = match mem.aris.get(get_ext(lnk) as usize) {
-    Some(Arity(arit)) => *arit,
-    None              => 0,
-  };
-  // TODO: remove this in a future update where ari will be removed from the lnk
-  //if get_ari(lnk) != got {
-    //println!("[WARNING] arity inconsistency");
-  //}
-  return got;
+pub fn ask_ari(_mem: &Worker, lnk: Ptr) -> u64 {
+  get_ari(lnk)
 }
 
 pub fn ask_lnk(mem: &Worker, loc: u64) -> Ptr {
@@ -429,7 +482,7 @@ pub fn clear(mem: &mut Worker, loc: u64, size: u64) {
 }
 
 pub fn collect(mem: &mut Worker, term: Ptr) {
-  let mut stack: Vec<Ptr> = Vec::new();
+  let mut stack = std::mem::take(&mut mem.dead);
   let mut next = term;
   //let mut dups : Vec<u64> = Vec::new();
   loop {
@@ -472,7 +525,7 @@ pub fn collect(mem: &mut Worker, term: Ptr) {
         clear(mem, get_loc(term, 0), 2);
         continue;
       }
-      NUM => {}
+      NUM | FLO => {}
       CTR | FUN => {
         let arity = ask_ari(mem, term);
         for i in 0..arity {
@@ -495,6 +548,7 @@ pub fn collect(mem: &mut Worker, term: Ptr) {
       break;
     }
   }
+  mem.dead = stack;
   // TODO: add this to the C version
   //for dup in dups {
     //let fst = ask_arg(mem, dup, 0);
@@ -524,7 +578,7 @@ pub fn subst(mem: &mut Worker, lnk: Ptr, val: Ptr) {
 pub fn cal_par(mem: &mut Worker, host: u64, term: Ptr, argn: Ptr, n: u64) -> Ptr {
   inc_cost(mem);
   let arit = ask_ari(mem, term);
-  let func = get_ext(term);
+  let func = get_fun(term);
   let fun0 = get_loc(term, 0);
   let fun1 = alloc(mem, arit);
   let par0 = get_loc(argn, 0);
@@ -547,6 +601,237 @@ pub fn cal_par(mem: &mut Worker, host: u64, term: Ptr, argn: Ptr, n: u64) -> Ptr
   done
 }
 
+// Bytecode
+// --------
+
+// The rules of a user function are compiled (by `builder::build_bytecode`) to a flat u64 array,
+// which `rewrite` runs in a single dispatch loop. Word 0 holds the number of registers used. Each
+// instruction is an opcode followed by its operands. Register 0 is always 0, the next ones hold the
+// matched variables, and the last ones the locations of the nodes allocated for the right-hand
+// side. Since dispatching is what costs the most, the right-hand side is filled by a few large
+// instructions, and values are computed as `v + r[t] + (dups & m)`, so that fixed values (t = 0),
+// local links (m = 0) and dup links (m = !0) are written without branching.
+pub const OP_PAR     : u64 = 0x0; // PAR i                : if arg i is a SUP, applies cal_par and returns
+pub const OP_RULE    : u64 = 0x1; // RULE next            : starts a rule; failed matches jump to `next`
+pub const OP_NUM     : u64 = 0x2; // NUM i n              : matches if arg i is the number n
+pub const OP_CTR     : u64 = 0x3; // CTR i f              : matches if arg i is a constructor with id f
+pub const OP_VAL     : u64 = 0x4; // VAL i                : matches if arg i is a constructor or a number
+pub const OP_HOAS    : u64 = 0x5; // HOAS i               : matches as described on 'HOAS_OPT'
+pub const OP_LOAD    : u64 = 0x6; // LOAD n (i j)*n       : r[1+k] <- arg i (j = 0), or field j-1 of arg i
+pub const OP_ALLOC   : u64 = 0x7; // ALLOC r n s*n        : r[r+k] <- alloc(s)
+pub const OP_BODY    : u64 = 0x8; // BODY n (r j v t m)*n : writes the value on slot j of node r[r]
+pub const OP_EXT     : u64 = 0x9; // EXT r j e            : links variable r[e] to slot j of node r[r]
+pub const OP_RET     : u64 = 0xA; // RET v t m            : links the value to the host
+pub const OP_CLEAR   : u64 = 0xB; // CLEAR n              : counts a rewrite, and frees the n args of the call
+pub const OP_FREE    : u64 = 0xC; // FREE i n             : frees the n fields of arg i
+pub const OP_COLLECT : u64 = 0xD; // COLLECT e            : collects variable r[e]
+pub const OP_DONE    : u64 = 0xE; // DONE k               : adds k to the dup label counter and returns
+pub const OP_FAIL    : u64 = 0xF; // FAIL                 : no rule matched
+
+pub fn rewrite(mem: &mut Worker, code: &[u64], dups: &mut u64, host: u64, term: Ptr) -> bool {
+  unsafe {
+    let mut regs = std::mem::take(&mut mem.regs);
+    if (regs.len() as u64) < code[0] {
+      regs.resize(code[0] as usize, 0);
+    }
+    let dupx = (*dups & 0xFFFFFF) * EXT; // should be changed if the pointer format changes
+    let mut next = 0;
+    let mut pc = 1;
+    let done = loop {
+      let word = |k: usize| *code.get_unchecked(pc + k);
+      let reg = |k: usize| *regs.get_unchecked(*code.get_unchecked(pc + k) as usize);
+      match word(0) {
+        OP_PAR => {
+          let arg = ask_arg(mem, term, word(1));
+          if get_tag(arg) == SUP {
+            cal_par(mem, host, term, arg, word(1));
+            break true;
+          }
+          pc += 2;
+        }
+        OP_RULE => {
+          next = word(1) as usize;
+          pc += 2;
+        }
+        OP_NUM => {
+          let arg = ask_arg(mem, term, word(1));
+          pc = if get_tag(arg) == NUM && get_num(arg) == word(2) { pc + 3 } else { next };
+        }
+        OP_CTR => {
+          let arg = ask_arg(mem, term, word(1));
+          pc = if get_tag(arg) == CTR && get_fun(arg) == word(2) { pc + 3 } else { next };
+        }
+        OP_VAL => {
+          let tag = get_tag(ask_arg(mem, term, word(1)));
+          pc = if tag == CTR || tag == NUM || tag == FLO { pc + 2 } else { next };
+        }
+        OP_HOAS => {
+          let arg = ask_arg(mem, term, word(1));
+          let is_num = get_tag(arg) == NUM || get_tag(arg) == FLO;
+          let is_ctr = get_tag(arg) == CTR && ask_ari(mem, arg) == 0;
+          let is_hoas_ctr_num = get_tag(arg) == CTR && get_fun(arg) >= HOAS_CT0 && get_fun(arg) <= HOAS_NUM;
+          pc = if is_num || is_ctr || is_hoas_ctr_num { pc + 2 } else { next };
+        }
+        OP_LOAD => {
+          let size = word(1) as usize;
+          for k in 0 .. size {
+            let arg = ask_arg(mem, term, word(2 + k * 2));
+            let fld = word(3 + k * 2);
+            *regs.get_unchecked_mut(1 + k) = if fld == 0 { arg } else { ask_arg(mem, arg, fld - 1) };
+          }
+          pc += 2 + size * 2;
+        }
+        OP_ALLOC => {
+          let base = word(1) as usize;
+          let size = word(2) as usize;
+          for k in 0 .. size {
+            *regs.get_unchecked_mut(base + k) = alloc(mem, word(3 + k));
+          }
+          pc += 3 + size;
+        }
+        OP_BODY => {
+          let size = word(1) as usize;
+          for k in 0 .. size {
+            let elem = pc + 2 + k * 5;
+            let word = |k: usize| *code.get_unchecked(elem + k);
+            let node = *regs.get_unchecked(word(0) as usize) + word(1);
+            let value = word(2) + *regs.get_unchecked(word(3) as usize) + (dupx & word(4));
+            *mem.node.get_unchecked_mut(node as usize) = value;
+          }
+          pc += 2 + size * 5;
+        }
+        OP_EXT => {
+          link(mem, reg(1) + word(2), reg(3));
+          pc += 4;
+        }
+        OP_RET => {
+          link(mem, host, word(1) + reg(2) + (dupx & word(3)));
+          pc += 4;
+        }
+        OP_CLEAR => {
+          inc_cost(mem);
+          clear(mem, get_loc(term, 0), word(1));
+          pc += 2;
+        }
+        OP_FREE => {
+          clear(mem, get_loc(ask_arg(mem, term, word(1)), 0), word(2));
+          pc += 3;
+        }
+        OP_COLLECT => {
+          collect(mem, reg(1));
+          pc += 2;
+        }
+        OP_DONE => {
+          *dups += word(1);
+          break true;
+        }
+        _ => {
+          break false;
+        }
+      }
+    };
+    mem.regs = regs;
+    done
+  }
+}
+
+// Tiers
+// -----
+
+// With tiered execution, the bytecode of a function that got hot (called `TIER_CALLS` times, per
+// `CALL_COUNT`) is translated to C, and built as a shared object on a background thread (by
+// `compiler::build_rewriter`), while the interpreter goes on. Once it is ready, it is installed on
+// the function's `jitted` slot, and used for the rest of the run. The native rewriter works on this
+// worker's heap, calling back into it to allocate, free and collect nodes.
+
+pub const TIER_CALLS: u64 = 1 << 20; // calls after which a function is compiled
+pub const TIER_POLL: u64 = 1 << 12; // calls between checks for finished builds
+
+pub type Jitted = unsafe extern "C" fn(*mut JitCtx, u64, Ptr) -> u8;
+
+#[repr(C)]
+pub struct JitCtx {
+  pub node: *mut u64,
+  pub cost: *mut u64,
+  pub dups: *mut u64,
+  pub mem: *mut Worker,
+  pub alloc: extern "C" fn(*mut Worker, u64) -> u64,
+  pub clear: extern "C" fn(*mut Worker, u64, u64),
+  pub collect: extern "C" fn(*mut Worker, Ptr),
+  pub cal_par: extern "C" fn(*mut Worker, u64, Ptr, Ptr, u64),
+}
+
+pub struct Tiers {
+  asked: HashSet<u64>,
+  sender: mpsc::Sender<(u64, Result<usize, String>)>,
+  receiver: mpsc::Receiver<(u64, Result<usize, String>)>,
+}
+
+pub fn new_tiers() -> Tiers {
+  let (sender, receiver) = mpsc::channel();
+  Tiers { asked: HashSet::new(), sender, receiver }
+}
+
+pub fn tier_up(mem: &mut Worker, funs: &Funs, fid: u64) {
+  let calls = unsafe { CALL_COUNT[fid as usize] };
+  if calls % TIER_POLL != 0 {
+    return;
+  }
+  if let Some(tiers) = &mut mem.tiers {
+    // Installs the functions built since the last check
+    while let Ok((done_fid, built)) = tiers.receiver.try_recv() {
+      match (built, funs.get(done_fid as usize)) {
+        (Ok(jitted), Some(Some(f))) => unsafe {
+          f.jitted.set(Some(std::mem::transmute::<usize, Jitted>(jitted)));
+        },
+        (Err(err), _) => {
+          eprintln!("Couldn't compile function {}, interpreting it: {}", done_fid, err);
+        }
+        _ => {}
+      }
+    }
+    // Starts building this function, if it got hot
+    if calls >= TIER_CALLS && tiers.asked.insert(fid) {
+      if let Some(Some(Function { rewriter: Rewriter::Bytecode(code), .. })) = funs.get(fid as usize) {
+        let code = code.clone();
+        let sender = tiers.sender.clone();
+        std::thread::spawn(move || {
+          sender.send((fid, crate::compiler::build_rewriter(&code))).ok();
+        });
+      }
+    }
+  }
+}
+
+pub fn rewrite_jitted(mem: &mut Worker, jitted: Jitted, dups: &mut u64, host: u64, term: Ptr) -> bool {
+  extern "C" fn jit_alloc(mem: *mut Worker, size: u64) -> u64 {
+    alloc(unsafe { &mut *mem }, size)
+  }
+  extern "C" fn jit_clear(mem: *mut Worker, loc: u64, size: u64) {
+    clear(unsafe { &mut *mem }, loc, size)
+  }
+  extern "C" fn jit_collect(mem: *mut Worker, term: Ptr) {
+    collect(unsafe { &mut *mem }, term)
+  }
+  extern "C" fn jit_cal_par(mem: *mut Worker, host: u64, term: Ptr, argn: Ptr, n: u64) {
+    cal_par(unsafe { &mut *mem }, host, term, argn, n);
+  }
+  let mem: *mut Worker = mem;
+  unsafe {
+    let mut ctx = JitCtx {
+      node: (*mem).node.as_mut_ptr(),
+      cost: std::ptr::addr_of_mut!((*mem).cost),
+      dups,
+      mem,
+      alloc: jit_alloc,
+      clear: jit_clear,
+      collect: jit_collect,
+      cal_par: jit_cal_par,
+    };
+    jitted(&mut ctx, host, term) != 0
+  }
+}
+
 pub fn reduce(
   mem: &mut Worker,
   funs: &Funs,
@@ -582,12 +867,12 @@ pub fn reduce(
         }
         OP2 => {
           stack.push(host);
-          stack.push(get_loc(term, 1) | 0x80000000);
+          stack.push(get_loc(term, 1) | 0x8000_0000_0000_0000);
           host = get_loc(term, 0);
           continue;
         }
         FUN => {
-          let fid = get_ext(term);
+          let fid = get_fun(term);
           //let ari = ask_ari(mem, term);
           if let Some(Some(f)) = &funs.get(fid as usize) {
             let len = f.stricts.len() as u64;
@@ -597,7 +882,7 @@ pub fn reduce(
               stack.push(host);
               for (i, strict) in f.stricts.iter().enumerate() {
                 if i < f.stricts.len() - 1 {
-                  stack.push(get_loc(term, *strict) | 0x80000000);
+                  stack.push(get_loc(term, *strict) | 0x8000_0000_0000_0000);
                 } else {
                   host = get_loc(term, *strict);
                 }
@@ -702,7 +987,7 @@ pub fn reduce(
               let done = Par(get_ext(arg0), if get_tag(term) == DP0 { par0 } else { par1 });
               link(mem, host, done);
             }
-          } else if get_tag(arg0) == NUM {
+          } else if get_tag(arg0) == NUM || get_tag(arg0) == FLO {
             //println!("dup-u32");
             inc_cost(mem);
             subst(mem, ask_arg(mem, term, 0), arg0);
@@ -713,7 +998,7 @@ pub fn reduce(
           } else if get_tag(arg0) == CTR {
             //println!("dup-ctr");
             inc_cost(mem);
-            let fnid = get_ext(arg0);
+            let fnid = get_fun(arg0);
             let arit = ask_ari(mem, arg0);
             if arit == 0 {
               subst(mem, ask_arg(mem, term, 0), Ctr(0, fnid, 0));
@@ -780,6 +1065,29 @@ pub fn reduce(
             let done = Num(c);
             clear(mem, get_loc(term, 0), 2);
             link(mem, host, done);
+          } else if (get_tag(arg0) == FLO || get_tag(arg1) == FLO)
+            && (get_tag(arg0) == FLO || get_tag(arg0) == NUM)
+            && (get_tag(arg1) == FLO || get_tag(arg1) == NUM)
+            && (get_ext(term) <= MOD || get_ext(term) >= LTN)
+          {
+            inc_cost(mem);
+            let a = get_real(arg0);
+            let b = get_real(arg1);
+            let done = match get_ext(term) {
+              ADD => Flo(flo_val(a + b)),
+              SUB => Flo(flo_val(a - b)),
+              MUL => Flo(flo_val(a * b)),
+              DIV => Flo(flo_val(a / b)),
+              MOD => Flo(flo_val(flo_mod(a, b))),
+              LTN => Num(u64::from(a <  b)),
+              LTE => Num(u64::from(a <= b)),
+              EQL => Num(u64::from(a == b)),
+              GTE => Num(u64::from(a >= b)),
+              GTN => Num(u64::from(a >  b)),
+              _   => Num(u64::from(a != b)),
+            };
+            clear(mem, get_loc(term, 0), 2);
+            link(mem, host, done);
           } else if get_tag(arg0) == SUP {
             //println!("op2-sup-0");
             inc_cost(mem);
@@ -815,13 +1123,21 @@ pub fn reduce(
           }
         }
         FUN => {
-          let fid = get_ext(term);
+          let fid = get_fun(term);
           let _ari = ask_ari(mem, term);
           if let Some(Some(f)) = &funs.get(fid as usize) {
             // FIXME: is this logic correct? remove this comment if yes
             let mut dups = mem.dups;
-            if (f.rewriter)(mem, funs, &mut dups, host, term) {
-              //unsafe { CALL_COUNT[fun as usize] += 1; } //TODO: uncomment
+            let done = match (&f.rewriter, f.jitted.get()) {
+              (_, Some(jitted)) => rewrite_jitted(mem, jitted, &mut dups, host, term),
+              (Rewriter::Bytecode(code), None) => rewrite(mem, code, &mut dups, host, term),
+              (Rewriter::Native(native), None) => native(mem, funs, &mut dups, host, term),
+            };
+            if done {
+              unsafe { CALL_COUNT[fid as usize] += 1; }
+              if mem.tiers.is_some() {
+                tier_up(mem, funs, fid);
+              }
               init = 1;
               mem.dups = dups;
               continue;
@@ -835,8 +1151,8 @@ pub fn reduce(
     }
 
     if let Some(item) = stack.pop() {
-      init = item >> 31;
-      host = item & 0x7FFFFFFF;
+      init = item >> 63;
+      host = item & 0x7FFF_FFFF_FFFF_FFFF;
       continue;
     }
 
@@ -944,7 +1260,7 @@ pub fn run_io(
     let term = reduce(mem, funs, host, i2n, debug);
     match get_tag(term) {
       CTR => {
-        match get_ext(term) {
+        match get_fun(term) {
           // IO.done a : (IO a)
           IO_DONE => {
             let done = ask_arg(mem, term, 0);
@@ -1081,7 +1397,7 @@ pub fn readback_string(mem: &mut Worker, funs: &Funs, host: u64) -> Option<Strin
     let term = reduce(mem, funs, host, None, false);
     match get_tag(term) {
       CTR => {
-        match get_ext(term) {
+        match get_fun(term) {
           STRING_NIL => {
             break;
           }
@@ -1156,6 +1472,7 @@ pub fn show_lnk(x: Ptr) -> String {
       FUN => "FUN",
       OP2 => "OP2",
       NUM => "NUM",
+      FLO => "FLO",
       _ => "?",
     };
     format!("{}:{:x}:{:x}", tgs, ext, val)
@@ -1296,8 +1613,11 @@ pub fn show_term(
       NUM => {
         format!("{}", get_val(term))
       }
+      FLO => {
+        crate::language::show_flo(get_num(term))
+      }
       CTR | FUN => {
-        let func = get_ext(term);
+        let func = get_fun(term);
         let arit = ask_ari(mem, term);
         let args: Vec<String> =
           (0..arit).map(|i| go(mem, ask_arg(mem, term, i), names, i2n, focus)).collect();
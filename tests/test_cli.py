@@ -164,12 +164,19 @@ def run_cases(differ: Differ, mode: TestMode, test_name: str, specs: Any):
         case_args = spec["input"]
         expected_out = spec["output"]
 
+        # Optional: runtime flags, and the args of a first run that saves a
+        # heap image, which the case then loads
+        flags = spec.get("flags", [])
+        image_args = spec.get("image")
+
         success = run_test_case(
             differ,
             mode,
             case_name,
-            case_args,
+            case_args if isinstance(case_args, list) else [case_args],
             expected_out,
+            flags,
+            image_args,
         )
         yield TestResult(get_mode_str(mode), test_name, case_name, success)
 
@@ -178,21 +185,39 @@ def run_test_case(
     differ: Differ,
     mode: TestMode,
     case_name: str,
-    case_args: str,  # TODO: refactor to list
+    case_args: List[str],
     expected_out: str,
+    flags: List[str],
+    image_args: Optional[List[str]],
 ) -> bool:
     mode_txt = get_mode_str(mode)
     print(f"Case '{case_name}' ({mode_txt})... ".ljust(45), end="")
 
+    image_path = None
     match mode:
         case Interpreted(hvm_cmd, program_path):
+            if image_args is not None or flags:
+                print("⏭ SKIPPED (compiled runtime options)")
+                return True
             code_path_abs = resolve_path(program_path)
-            cmd = [hvm_cmd, "run", code_path_abs, case_args]
+            cmd = [hvm_cmd, "run", code_path_abs, *case_args]
         case Compiled(program_path) | SingleThread(program_path):
             program_path_abs = resolve_path(program_path)
-            cmd = [program_path_abs, case_args]
+            cmd = [program_path_abs, *flags]
+            if image_args is not None:
+                image_path = resolve_path(program_path.with_suffix(".img"))
+                p = subprocess.run(
+                    [*cmd, "-S", image_path, *image_args], capture_output=True)
+                if p.returncode != 0:
+                    print("❌ FAILED")
+                    print(p.stderr.decode('utf-8'))
+                    return False
+                cmd += ["-L", image_path]
+            cmd += case_args
 
     p = subprocess.run(cmd, capture_output=True)
+    if image_path is not None:
+        Path(image_path).unlink(missing_ok=True)
 
     if p.returncode != 0:
         print("❌ FAILED")